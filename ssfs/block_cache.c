@@ -0,0 +1,571 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "block_cache.h"
+#include "disk_emu.h"
+
+typedef struct _cache_slot_t {
+	int block;	// disk block held in this slot, -1 if empty
+	char dirty;
+	char ref;	// CLOCK reference bit, set on every access
+	char writing;	// a background write of a snapshot is in flight
+	char busy;	// being read in or written back with cache_lock dropped
+	unsigned int gen;	// bumped on every write, see cache_mark_clean
+} cache_slot_t;
+
+static cache_slot_t *slots = NULL;
+static char *data = NULL;		// capacity * block_size bytes, one block per slot
+static int *table = NULL;		// open addressing: block -> slot index, -1 if empty
+static int table_mask = 0;
+static int capacity = 0;
+static int used = 0;
+static int hand = 0;			// CLOCK hand
+static int bsize = 0;
+static cache_stats_t stats;
+
+// every public function holds it, except around disk reads of missing
+// blocks, write-backs of evicted ones and waits for background writes
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_done = PTHREAD_COND_INITIALIZER;	// a busy slot is not busy any more
+
+static void lock() {
+	pthread_mutex_lock(&cache_lock);
+}
+
+static void unlock() {
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static void wait_slot() {
+	pthread_cond_wait(&slot_done, &cache_lock);
+}
+
+/*
+ * Hash table from block number to slot, using linear probing.
+ * Deletion shifts the following entries back so no tombstones are needed.
+ */
+static int hash_block(int block) {
+	return (int)(((unsigned int)block * 2654435761u) & (unsigned int)table_mask);
+}
+
+static int table_find(int block) {
+	for (int h = hash_block(block); table[h] != -1; h = (h + 1) & table_mask)
+		if (slots[table[h]].block == block)
+			return table[h];
+	return -1;
+}
+
+static void table_insert(int block, int slot) {
+	int h = hash_block(block);
+	while (table[h] != -1)
+		h = (h + 1) & table_mask;
+	table[h] = slot;
+}
+
+static void table_remove(int block) {
+	int h = hash_block(block);
+	while (slots[table[h]].block != block)
+		h = (h + 1) & table_mask;
+	table[h] = -1;
+
+	// re-place every entry of the cluster that followed the hole
+	for (int i = (h + 1) & table_mask; table[i] != -1; i = (i + 1) & table_mask) {
+		int slot = table[i];
+		table[i] = -1;
+		table_insert(slots[slot].block, slot);
+	}
+}
+
+static char *slot_data(int slot) {
+	return data + (size_t)slot * bsize;
+}
+
+// the slot holding block, once it is not busy; -1 if the block is not cached
+static int find_ready(int block) {
+	for (;;) {
+		int slot = table_find(block);
+		if (slot == -1 || !slots[slot].busy)
+			return slot;
+		wait_slot();
+	}
+}
+
+// lets the background writes in flight land, with cache_lock dropped
+static void drain_unlocked() {
+	unlock();
+	disk_aio_drain();
+	lock();
+}
+
+// a failed background write never reports back; once none is in flight, none is pending
+static void forget_writes() {
+	for (int i = 0; i < used; i++)
+		slots[i].writing = 0;
+}
+
+/*
+ * returns a free slot, evicting with CLOCK if the cache is full.
+ * busy slots and blocks with a background write in flight are passed
+ * over. a dirty victim is written back with cache_lock dropped, and the
+ * slot stays busy meanwhile so nobody reads or changes it; the caller then
+ * has to look again, as it has to whenever nothing could be evicted. a
+ * caller holding busy slots of its own passes can_wait 0: they may be all
+ * there is, so it must not wait for slots to stop being busy.
+ * returns the slot index, -1 on error, or -2 if cache_lock was dropped.
+ */
+static int get_free_slot(int can_wait) {
+	if (used < capacity)
+		return used++;
+
+	int busy = 0;
+	for (int step = 0; step < 2 * capacity; step++) {
+		cache_slot_t *s = &slots[hand];
+		int victim = hand;
+		hand = (hand + 1) % capacity;
+
+		if (s->busy) {
+			busy = 1;
+			continue;
+		}
+		if (s->block == -1)
+			return victim;	// its read failed
+		if (s->ref) {
+			s->ref = 0;
+			continue;
+		}
+		// an older background write of this block must not land after this one
+		if (s->writing)
+			continue;
+
+		if (s->dirty) {
+			s->busy = 1;
+			unlock();
+			int ret = write_blocks(s->block, 1, slot_data(victim)) == 1 ? -2 : -1;
+			lock();
+			s->busy = 0;
+			if (ret == -2) {
+				s->dirty = 0;
+				stats.writebacks++;
+			}
+			pthread_cond_broadcast(&slot_done);
+			return ret;
+		}
+		table_remove(s->block);
+		s->block = -1;
+		stats.evictions++;
+		return victim;
+	}
+
+	// every slot is busy or waits on a background write
+	if (busy) {
+		if (can_wait)
+			wait_slot();
+	} else if (disk_aio_inflight() > 0)
+		drain_unlocked();
+	else
+		forget_writes();
+	return -2;
+}
+
+// takes a free slot for block: returns its index, -1 on error or -2 if cache_lock was dropped
+static int claim_slot(int block, int can_wait) {
+	int slot = get_free_slot(can_wait);
+	if (slot < 0)
+		return slot;
+	slots[slot].block = block;
+	slots[slot].dirty = 0;
+	slots[slot].writing = 0;
+	slots[slot].busy = 0;
+	table_insert(block, slot);
+	return slot;
+}
+
+/*
+ * puts a block in the cache (or refreshes it if already there).
+ * returns the slot holding it, -1 on error, or -2 if cache_lock was
+ * dropped on the way and nothing was done: call again.
+ */
+static int cache_fill(int block, char *src, int dirty) {
+	int slot = find_ready(block);
+	if (slot == -1) {
+		slot = claim_slot(block, 1);
+		if (slot < 0)
+			return slot;
+	}
+	memcpy(slot_data(slot), src, bsize);
+	slots[slot].ref = 1;
+	slots[slot].dirty |= dirty;
+	if (dirty)
+		slots[slot].gen++;
+	return slot;
+}
+
+/*
+ * reads the missing blocks [block, block + n) from disk into out and
+ * caches them. their slots are claimed busy first and the read runs with
+ * cache_lock dropped, so other threads keep using the cache meanwhile and
+ * wait on slot_done only for these blocks. stops early if finding room
+ * dropped the lock, since the rest of the run may have been read since.
+ * returns the number of blocks read (0: look again), or -1 on error.
+ */
+static int load_run(int block, int n, char *out) {
+	int *claimed = (int*)malloc(n * sizeof(int));
+	int got = 0;
+	while (got < n) {
+		int slot = claim_slot(block + got, got == 0);
+		if (slot == -2)
+			break;
+		if (slot == -1) {
+			n = -1;
+			break;
+		}
+		slots[slot].busy = 1;
+		claimed[got++] = slot;
+	}
+
+	int ret = n == -1 ? -1 : got;
+	if (got > 0) {
+		unlock();
+		if (read_blocks(block, got, out) != got)
+			ret = -1;
+		lock();
+	}
+	for (int i = 0; i < got; i++) {
+		cache_slot_t *s = &slots[claimed[i]];
+		s->busy = 0;
+		if (ret == -1) {
+			table_remove(s->block);
+			s->block = -1;
+			continue;
+		}
+		memcpy(slot_data(claimed[i]), out + (size_t)i * bsize, bsize);
+		s->ref = 1;
+	}
+	if (got > 0)
+		pthread_cond_broadcast(&slot_done);
+	free(claimed);
+	return ret;
+}
+
+/*
+ * allocates a cache of `capacity` blocks of `block_size` bytes.
+ * a capacity of 0 disables caching; reads and writes go straight to disk.
+ * returns 0 on success, -1 on error.
+ */
+static void destroy_unlocked();
+
+static int init_unlocked(int cap, int block_size) {
+	destroy_unlocked();
+	memset(&stats, 0, sizeof(cache_stats_t));
+
+	if (cap <= 0)
+		return 0;
+
+	int table_size = 1;
+	while (table_size < cap * 2)
+		table_size <<= 1;
+
+	slots = (cache_slot_t*)calloc(cap, sizeof(cache_slot_t));
+	data  = (char*)malloc((size_t)cap * block_size);
+	table = (int*)malloc(table_size * sizeof(int));
+	if (slots == NULL || data == NULL || table == NULL) {
+		fprintf(stderr, "Error: Could not allocate a block cache of %d blocks\n", cap);
+		free(slots); free(data); free(table);
+		slots = NULL; data = NULL; table = NULL;
+		return -1;
+	}
+
+	for (int i = 0; i < cap; i++)
+		slots[i].block = -1;
+	for (int i = 0; i < table_size; i++)
+		table[i] = -1;
+
+	table_mask = table_size - 1;
+	capacity = cap;
+	used = 0;
+	hand = 0;
+	bsize = block_size;
+	stats.capacity = cap;
+	return 0;
+}
+
+int cache_init(int cap, int block_size) {
+	lock();
+	int ret = init_unlocked(cap, block_size);
+	unlock();
+	return ret;
+}
+
+static int flush_unlocked();
+
+// writes back all dirty blocks and releases the cache
+static void destroy_unlocked() {
+	if (slots == NULL)
+		return;
+
+	flush_unlocked();
+	free(slots);
+	free(data);
+	free(table);
+	slots = NULL;
+	data = NULL;
+	table = NULL;
+	capacity = 0;
+	used = 0;
+	stats.capacity = 0;
+}
+
+void cache_destroy() {
+	lock();
+	destroy_unlocked();
+	unlock();
+}
+
+/*
+ * reads nblocks starting at start_address into buffer.
+ * each run of missing blocks is fetched with a single read_blocks call,
+ * see load_run. a block another thread is reading in is waited for.
+ * returns the number of blocks read, or -1 on error.
+ */
+static int read_unlocked(int start_address, int nblocks, void *buffer) {
+	if (slots == NULL)
+		return read_blocks(start_address, nblocks, buffer);
+
+	char *out = (char*)buffer;
+	int i = 0;
+	while (i < nblocks) {
+		int slot = find_ready(start_address + i);
+		if (slot != -1) {
+			memcpy(out + (size_t)i * bsize, slot_data(slot), bsize);
+			slots[slot].ref = 1;
+			stats.hits++;
+			i++;
+			continue;
+		}
+
+		int run = 1;
+		while (i + run < nblocks && table_find(start_address + i + run) == -1)
+			run++;
+
+		run = load_run(start_address + i, run, out + (size_t)i * bsize);
+		if (run == -1)
+			return -1;
+		stats.misses += run;
+		i += run;
+	}
+	return nblocks;
+}
+
+int cache_read(int start_address, int nblocks, void *buffer) {
+	lock();
+	int ret = read_unlocked(start_address, nblocks, buffer);
+	unlock();
+	return ret;
+}
+
+/*
+ * writes nblocks from buffer into the cache, marking them dirty.
+ * returns the number of blocks written, or -1 on error.
+ */
+static int write_unlocked(int start_address, int nblocks, void *buffer) {
+	if (slots == NULL)
+		return write_blocks(start_address, nblocks, buffer);
+
+	char *in = (char*)buffer;
+	for (int i = 0; i < nblocks; ) {
+		int slot = cache_fill(start_address + i, in + (size_t)i * bsize, 1);
+		if (slot == -1)
+			return -1;
+		if (slot != -2)
+			i++;
+	}
+	return nblocks;
+}
+
+int cache_write(int start_address, int nblocks, void *buffer) {
+	lock();
+	int ret = write_unlocked(start_address, nblocks, buffer);
+	unlock();
+	return ret;
+}
+
+/* 
+ * reads the blocks in [start_address, start_address + nblocks) that are
+ * not cached yet into the cache, without copying them out: used for
+ * read-ahead. at most half of the cache is filled by one call, so a large
+ * prefetch cannot push out everything else.
+ * returns the number of blocks read from disk, or -1 on error.
+ */
+static int prefetch_unlocked(int start_address, int nblocks) {
+	if (slots == NULL)
+		return 0;
+	if (nblocks > capacity / 2)
+		nblocks = capacity / 2;
+
+	char *buf = NULL;
+	int fetched = 0;
+	int i = 0;
+	while (i < nblocks) {
+		if (table_find(start_address + i) != -1) {
+			i++;
+			continue;
+		}
+
+		int run = 1;
+		while (i + run < nblocks && table_find(start_address + i + run) == -1)
+			run++;
+
+		if (buf == NULL)
+			buf = (char*)malloc((size_t)nblocks * bsize);
+		run = load_run(start_address + i, run, buf);
+		if (run == -1) {
+			free(buf);
+			return -1;
+		}
+		fetched += run;
+		i += run;
+	}
+	free(buf);
+	stats.prefetched += fetched;
+	return fetched;
+}
+
+int cache_prefetch(int start_address, int nblocks) {
+	lock();
+	int ret = prefetch_unlocked(start_address, nblocks);
+	unlock();
+	return ret;
+}
+
+// returns 1 if the block is cached, 0 otherwise
+int cache_contains(int block) {
+	lock();
+	int found = slots != NULL && table_find(block) != -1;
+	unlock();
+	return found;
+}
+
+/* 
+ * copies a dirty cached block into buf, with its write generation, so that
+ * it can be written back in the background. a block whose previous
+ * background write is still in flight is left alone: two writes of it in
+ * flight at once could land out of order.
+ * returns 1 if the block was snapshotted, 0 otherwise.
+ */
+int cache_snapshot(int block, void *buf, unsigned int *gen) {
+	lock();
+	int slot = slots == NULL ? -1 : find_ready(block);
+	int found = slot != -1 && slots[slot].dirty && !slots[slot].writing;
+	if (found) {
+		memcpy(buf, slot_data(slot), bsize);
+		*gen = slots[slot].gen;
+		slots[slot].writing = 1;
+	}
+	unlock();
+	return found;
+}
+
+// a background write of the snapshot taken at gen finished: clean unless written since
+void cache_mark_clean(int block, unsigned int gen) {
+	lock();
+	int slot = slots == NULL ? -1 : table_find(block);
+	if (slot != -1)
+		slots[slot].writing = 0;
+	if (slot != -1 && slots[slot].dirty && slots[slot].gen == gen) {
+		slots[slot].dirty = 0;
+		stats.writebacks++;
+	}
+	unlock();
+}
+
+static int cmp_slot_block(const void *a, const void *b) {
+	return slots[*(const int*)a].block - slots[*(const int*)b].block;
+}
+
+/*
+ * writes every dirty block back to disk in block order, so that
+ * neighbouring blocks go out as one vectored write, then flushes the disk.
+ * returns 0 on success, -1 on error.
+ */
+static int flush_unlocked() {
+	if (slots == NULL)
+		return flush_disk();
+
+	// background writes in flight are older than what is cached: let them land first
+	for (;;) {
+		int busy = 0, writing = 0;
+		for (int i = 0; i < used; i++) {
+			busy |= slots[i].busy;
+			writing |= slots[i].writing;
+		}
+		if (busy)
+			wait_slot();
+		else if (writing && disk_aio_inflight() > 0)
+			drain_unlocked();
+		else
+			break;
+	}
+
+	int ndirty = 0;
+	int *dirty = (int*)malloc(used * sizeof(int) + 1);
+	for (int i = 0; i < used; i++)
+		if (slots[i].block != -1 && slots[i].dirty)
+			dirty[ndirty++] = i;
+
+	qsort(dirty, ndirty, sizeof(int), cmp_slot_block);
+
+	int *addresses = (int*)malloc(ndirty * sizeof(int) + 1);
+	void **buffers = (void**)malloc(ndirty * sizeof(void*) + 1);
+	for (int i = 0; i < ndirty; i++) {
+		addresses[i] = slots[dirty[i]].block;
+		buffers[i] = slot_data(dirty[i]);
+	}
+
+	int ret = 0;
+	if (ndirty > 0 && write_blocks_v(addresses, ndirty, buffers) != ndirty) {
+		ret = -1;
+	} else {
+		for (int i = 0; i < ndirty; i++) {
+			slots[dirty[i]].dirty = 0;
+			slots[dirty[i]].writing = 0;	// drained above, see forget_writes
+		}
+		stats.writebacks += ndirty;
+	}
+
+	free(dirty);
+	free(addresses);
+	free(buffers);
+
+	if (flush_disk() != 0)
+		ret = -1;
+	return ret;
+}
+
+int cache_flush() {
+	lock();
+	int ret = flush_unlocked();
+	unlock();
+	return ret;
+}
+
+void cache_get_stats(cache_stats_t *out) {
+	lock();
+	stats.used = used;
+	stats.dirty = 0;
+	for (int i = 0; i < used; i++)
+		if (slots[i].dirty)
+			stats.dirty++;
+	*out = stats;
+	unlock();
+}
+
+void cache_reset_stats() {
+	lock();
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.evictions = 0;
+	stats.writebacks = 0;
+	stats.prefetched = 0;
+	unlock();
+}
@@ -0,0 +1,34 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+// Write-back block cache sitting between sfs_api and disk_emu.
+// Blocks are replaced with the CLOCK algorithm; dirty blocks only reach
+// the disk when they are evicted or on cache_flush/cache_destroy, or when
+// a background write of a cache_snapshot() completes (cache_mark_clean).
+// Every function is safe to call from several threads; cache_init and
+// cache_destroy still need the callers to be quiescent.
+
+typedef struct _cache_stats_t {
+	long hits;
+	long misses;
+	long evictions;
+	long writebacks;	// dirty blocks written to disk (evictions + flushes)
+	long prefetched;	// blocks read ahead by cache_prefetch
+	int capacity;		// in blocks
+	int used;
+	int dirty;
+} cache_stats_t;
+
+int  cache_init(int capacity, int block_size);
+void cache_destroy();
+int  cache_read(int start_address, int nblocks, void *buffer);
+int  cache_write(int start_address, int nblocks, void *buffer);
+int  cache_prefetch(int start_address, int nblocks);
+int  cache_contains(int block);
+int  cache_snapshot(int block, void *buf, unsigned int *gen);
+void cache_mark_clean(int block, unsigned int gen);
+int  cache_flush();
+void cache_get_stats(cache_stats_t *stats);
+void cache_reset_stats();
+
+#endif
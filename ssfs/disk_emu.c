@@ -1,64 +1,458 @@
 #include <stdio.h>
-#include <stdlib.h> 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <pthread.h>
 #include "disk_emu.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-FILE* fp = NULL;
-double L, p;
-double r;
-int BLOCK_SIZE, MAX_BLOCK, MAX_RETRY, lru;
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#undef BLOCK_SIZE       /*Pulled in from linux/fs.h, clashes with ours*/
+#endif
+#endif
+
+#define AIO_WORKERS 64  /*Most threads of the pread/pwrite fallback engine, one per request in flight*/
+#define MAX_CHANNELS 64 /*Most requests the device model serves at once*/
+
+#define SCHED_MAX_MERGE     256     /*Most blocks the scheduler merges into one transfer*/
+#define SCHED_READ_EXPIRE   50000   /*Microseconds a queued read waits before it jumps the elevator*/
+#define SCHED_WRITE_EXPIRE  500000
+
+
+int fd = -1;
+char* map = NULL;     /*Base of the mapped image (DISK_BACKEND_MMAP only)*/
+size_t map_size = 0;
+int backend = DISK_BACKEND_PIO;
+int BLOCK_SIZE, MAX_BLOCK;
+static disk_stats_t stats;    /*Updated with relaxed atomics, transfers may run on several threads*/
+
+/*----------------------------------------------------------*/
+/*Maps the whole disk file into memory for DISK_BACKEND_MMAP */
+/*----------------------------------------------------------*/
+static int map_disk()
+{
+    map_size = (size_t)MAX_BLOCK * BLOCK_SIZE;
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        printf("Could not map disk file\n\n");
+        map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------*/
+/*Counts one transfer of nblocks that succeeded              */
+/*----------------------------------------------------------*/
+static void count_io(int is_write, int nblocks)
+{
+    if (is_write)
+    {
+        __atomic_add_fetch(&stats.writes, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats.blocks_written, nblocks, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch(&stats.reads, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats.blocks_read, nblocks, __ATOMIC_RELAXED);
+    }
+}
+
+void disk_get_stats(disk_stats_t *out)
+{
+    out->reads = __atomic_load_n(&stats.reads, __ATOMIC_RELAXED);
+    out->writes = __atomic_load_n(&stats.writes, __ATOMIC_RELAXED);
+    out->blocks_read = __atomic_load_n(&stats.blocks_read, __ATOMIC_RELAXED);
+    out->blocks_written = __atomic_load_n(&stats.blocks_written, __ATOMIC_RELAXED);
+}
+
+void disk_reset_stats()
+{
+    __atomic_store_n(&stats.reads, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.writes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.blocks_read, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.blocks_written, 0, __ATOMIC_RELAXED);
+}
+
+/*----------------------------------------------------------*/
+/*pread/pwrite until the whole range is transferred          */
+/*----------------------------------------------------------*/
+static int pread_full(void *buffer, size_t length, off_t offset)
+{
+    ssize_t n;
+
+    while (length > 0)
+    {
+        n = pread(fd, buffer, length, offset);
+        if (n <= 0)
+            return -1;
+        buffer = (char*)buffer + n;
+        length -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int pwrite_full(void *buffer, size_t length, off_t offset)
+{
+    ssize_t n;
+
+    while (length > 0)
+    {
+        n = pwrite(fd, buffer, length, offset);
+        if (n <= 0)
+            return -1;
+        buffer = (char*)buffer + n;
+        length -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------*/
+/*Moves an iovec array forward by n transferred bytes        */
+/*----------------------------------------------------------*/
+static int advance_iov(struct iovec **iov, int iovcnt, size_t n)
+{
+    while (iovcnt > 0 && n >= (*iov)->iov_len)
+    {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        iovcnt--;
+    }
+    if (iovcnt > 0)
+    {
+        (*iov)->iov_base = (char*)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+    return iovcnt;
+}
+
+/*-------------------------------------------------------------------*/
+/*One preadv/pwritev over a run of contiguous blocks whose buffers   */
+/*are scattered in memory                                            */
+/*-------------------------------------------------------------------*/
+static int transfer_run(int start_address, int nblocks, void **buffers, int is_write)
+{
+    struct iovec iov[IOV_MAX];
+    struct iovec *cur;
+    off_t offset = (off_t)start_address * BLOCK_SIZE;
+    ssize_t n;
+    int i, cnt;
+
+    while (nblocks > 0)
+    {
+        cnt = nblocks < IOV_MAX ? nblocks : IOV_MAX;
+        for (i = 0; i < cnt; i++)
+        {
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = BLOCK_SIZE;
+        }
+
+        cur = iov;
+        i = cnt;
+        while (i > 0)
+        {
+            if (is_write)
+                n = pwritev(fd, cur, i, offset);
+            else
+                n = preadv(fd, cur, i, offset);
+            if (n <= 0)
+                return -1;
+            offset += n;
+            i = advance_iov(&cur, i, n);
+        }
+
+        buffers += cnt;
+        nblocks -= cnt;
+    }
+    return 0;
+}
+
+/*===================================================================*/
+/*Device model                                                       */
+/*                                                                   */
+/*Each transfer is one request to a simulated device with up to      */
+/*queue_depth channels. It takes the channel that frees up first,    */
+/*starts when that channel (and the caller) is ready, and keeps it   */
+/*busy for latency + seek + transfer time, once per attempt if it    */
+/*fails and is retried. The caller then sleeps until the request's   */
+/*completion time, or with virtual_time only the device clock moves  */
+/*and the caller's next request starts no earlier than that time.    */
+/*A seeded generator makes runs repeatable.                          */
+/*===================================================================*/
+const disk_model_t disk_model_hdd = {
+    DISK_LATENCY_UNIFORM, 4170, 4170,   /*Half a turn at 7200 rpm on average*/
+    150000, 1,                          /*150 MB/s, one head*/
+    1000, 15000,                        /*Track to track, full stroke*/
+    0, 3, 1, 0
+};
+const disk_model_t disk_model_ssd = {
+    DISK_LATENCY_EXP, 80, 0,
+    500000, 32,                         /*500 MB/s, NCQ depth*/
+    0, 0,                               /*No seeks*/
+    0, 3, 1, 0
+};
+
+static disk_model_t model;
+static int model_on = 0;
+static int model_sleeps = 0;                  /*On and in real time: transfers take a while even on a mapped image*/
+static pthread_mutex_t model_lock = PTHREAD_MUTEX_INITIALIZER;
+static long long channel_free[MAX_CHANNELS];  /*Device time each channel is busy until*/
+static long long model_start;                 /*Host time of disk_set_model*/
+static long long model_clock;                 /*Latest completion so far, device time*/
+static int model_head;                        /*Block after the last one transferred*/
+static int model_gen;                         /*Bumped by disk_set_model, drops the caller times below*/
+static __thread long long caller_ready;       /*virtual_time: device time this thread's last request completed*/
+static __thread int caller_gen;
+static unsigned int model_seed;
+static int model_retries;
+
+static long long now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*Uniform in [0, 1), from the model's own generator*/
+static double model_random()
+{
+    return rand_r(&model_seed) / ((double)RAND_MAX + 1);
+}
+
+static long long model_latency()
+{
+    long long us = model.latency_us;
+
+    if (model.latency_dist == DISK_LATENCY_UNIFORM)
+        us += (long long)((2 * model_random() - 1) * model.jitter_us);
+    else if (model.latency_dist == DISK_LATENCY_EXP)
+        us = (long long)(-log(1 - model_random()) * model.latency_us) + model.jitter_us;
+    return us > 0 ? us : 0;
+}
+
+static long long model_seek(int start_address)
+{
+    long long distance = abs(start_address - model_head);
+
+    if (distance == 0)
+        return 0;
+    return model.seek_min_us + (model.seek_max_us - model.seek_min_us) * distance / MAX_BLOCK;
+}
+
+static long long model_bytes(int nblocks)
+{
+    if (model.bandwidth_kbs <= 0)
+        return 0;
+    return (long long)nblocks * BLOCK_SIZE * 1000000 / ((long long)model.bandwidth_kbs * 1024);
+}
+
+/*-------------------------------------------------------------------*/
+/*Sets the device model for the transfers that follow; NULL turns it */
+/*off. Kept across init_disk/init_fresh_disk. The io_uring engine    */
+/*bypasses it, so set it before disk_aio_init.                       */
+/*-------------------------------------------------------------------*/
+static void aio_model_changed();
+
+void disk_set_model(const disk_model_t *m)
+{
+    pthread_mutex_lock(&model_lock);
+    if (NULL != m)
+        model = *m;
+    memset(channel_free, 0, sizeof(channel_free));
+    model_start = now_us();
+    model_clock = 0;
+    model_head = 0;
+    model_seed = NULL != m ? m->seed : 0;
+    model_retries = 0;
+    model_gen++;
+    __atomic_store_n(&model_on, NULL != m, __ATOMIC_RELEASE);
+    __atomic_store_n(&model_sleeps, NULL != m && !m->virtual_time, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&model_lock);
+    aio_model_changed();
+}
+
+long long disk_model_clock()
+{
+    long long clock;
+
+    pthread_mutex_lock(&model_lock);
+    clock = model_clock;
+    pthread_mutex_unlock(&model_lock);
+    return clock;
+}
+
+int disk_model_retries()
+{
+    int n;
+
+    pthread_mutex_lock(&model_lock);
+    n = model_retries;
+    pthread_mutex_unlock(&model_lock);
+    return n;
+}
+
+/*-------------------------------------------------------------------*/
+/*Charges one request to the device and waits out its service time.  */
+/*Returns 0, or -1 if the first attempt and every retry failed       */
+/*-------------------------------------------------------------------*/
+static int model_request(int start_address, int nblocks)
+{
+    long long now, begin, service = 0;
+    struct timespec until;
+    int channels, ch, i, attempt, failed = 0;
+    int virtual_time;
+
+    if (!__atomic_load_n(&model_on, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_mutex_lock(&model_lock);
+    virtual_time = model.virtual_time;
+    if (!virtual_time)
+        now = now_us() - model_start;
+    else
+        /*Without sleeping, a caller is ready when its previous request would have completed*/
+        now = caller_gen == model_gen ? caller_ready : 0;
+
+    channels = model.queue_depth > 0 && model.queue_depth < MAX_CHANNELS ? model.queue_depth : MAX_CHANNELS;
+    ch = 0;
+    for (i = 1; i < channels; i++)
+        if (channel_free[i] < channel_free[ch])
+            ch = i;
+    begin = channel_free[ch] > now ? channel_free[ch] : now;
+
+    for (attempt = 0; ; attempt++)
+    {
+        service += model_latency() + model_seek(start_address) + model_bytes(nblocks);
+        model_head = start_address + nblocks;
+        if (model.fail_rate <= 0 || model_random() >= model.fail_rate)
+            break;
+        model_retries++;
+        if (attempt == model.max_retry)
+        {
+            failed = 1;
+            break;
+        }
+    }
+
+    channel_free[ch] = begin + service;
+    if (channel_free[ch] > model_clock)
+        model_clock = channel_free[ch];
+    caller_ready = channel_free[ch];
+    caller_gen = model_gen;
+    now = model_start + channel_free[ch];
+    pthread_mutex_unlock(&model_lock);
+
+    if (!virtual_time)
+    {
+        until.tv_sec = now / 1000000;
+        until.tv_nsec = now % 1000000 * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+            ;
+    }
+    return failed ? -1 : 0;
+}
 
 /*----------------------------------------------------------*/
 /*Close the disk file filled when you don't need it anymore. */
 /*----------------------------------------------------------*/
 int close_disk()
 {
-    if(NULL != fp)
+    disk_aio_drain();
+    if (NULL != map)
+    {
+        msync(map, map_size, MS_SYNC);
+        munmap(map, map_size);
+        map = NULL;
+    }
+    if(-1 != fd)
     {
-        fclose(fp);
+        close(fd);
+        fd = -1;
     }
     return 0;
 }
 
-/*---------------------------------------*/
-/*Initializes a disk file filled with 0's*/
-/*---------------------------------------*/
+/*----------------------------------------------------------*/
+/*Forces every block written so far out to the disk file     */
+/*----------------------------------------------------------*/
+int flush_disk()
+{
+    disk_aio_drain();
+    if (NULL != map)
+        return msync(map, map_size, MS_SYNC);
+    if (-1 != fd)
+        return fdatasync(fd);
+    return 0;
+}
+
+/*-------------------------------------------------------------------*/
+/*Returns a pointer to the mapped blocks, or NULL if not mmap-backed */
+/*-------------------------------------------------------------------*/
+void *map_blocks(int start_address, int nblocks)
+{
+    if (NULL == map || start_address < 0 || start_address + nblocks > MAX_BLOCK)
+        return NULL;
+    return map + (size_t)start_address * BLOCK_SIZE;
+}
+
+/*-------------------------------------------------------------*/
+/*Initializes a disk file filled with 0's. The file is sized with */
+/*ftruncate, so it is sparse: blocks never written take no space  */
+/*and read back as 0's, and a disk of any size is made at once.   */
+/*-------------------------------------------------------------*/
 int init_fresh_disk(char *filename, int block_size, int num_blocks)
 {
-    int i, j;
-    
-    /*Set up latency at 0.02 second*/
-    L = 00000.f;
-    /*Set up failure at 10%*/
-    p = -1.f;
-    /*Set up max retry attempts after failure to 3*/
-    MAX_RETRY = 3;
+    return init_fresh_disk_backend(filename, block_size, num_blocks, DISK_BACKEND_PIO);
+}
 
+int init_fresh_disk_backend(char *filename, int block_size, int num_blocks, int disk_backend)
+{
     BLOCK_SIZE = block_size;
     MAX_BLOCK = num_blocks;
-    
+    backend = disk_backend;
+
     /*Initializes the random number generator*/
     srand((unsigned int)(time( 0 )) );
     /*Creates a new file*/
-    fp = fopen (filename, "w+b");
+    fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
-    if (fp == NULL)
+    if (fd == -1)
     {
         printf("Could not create new disk file %s\n\n", filename);
         return -1;
     }
-    
-    /*Fills the file with 0's to its given size*/
-    for (i = 0; i < MAX_BLOCK; i++)
+
+    /*Extends the (empty) file with 0's to its given size*/
+    if (ftruncate(fd, (off_t)MAX_BLOCK * BLOCK_SIZE) != 0)
     {
-        for (j = 0; j < BLOCK_SIZE; j++)
-        {
-            fputc(0, fp);
-        }
+        printf("Could not fill disk file %s\n\n", filename);
+        close(fd);
+        fd = -1;
+        return -1;
     }
+
+    if (backend == DISK_BACKEND_MMAP)
+        return map_disk();
     return 0;
 }
 /*----------------------------*/
@@ -66,27 +460,29 @@ int init_fresh_disk(char *filename, int block_size, int num_blocks)
 /*----------------------------*/
 int init_disk(char *filename, int block_size, int num_blocks)
 {
-    /*Set up latency at 0.02 second*/
-    L = 00000.f;
-    /*Set up failure at 10%*/
-    p = -1.f;
-    /*Set up max retry attempts after failure to 3*/
-    MAX_RETRY = 3;
+    return init_disk_backend(filename, block_size, num_blocks, DISK_BACKEND_PIO);
+}
 
+int init_disk_backend(char *filename, int block_size, int num_blocks, int disk_backend)
+{
     BLOCK_SIZE = block_size;
     MAX_BLOCK = num_blocks;
-    
+    backend = disk_backend;
+
     /*Initializes the random number generator*/
     srand((unsigned int)(time( 0 )) );
-    
+
     /*Opens a file*/
-    fp = fopen (filename, "r+b");
+    fd = open(filename, O_RDWR);
 
-    if (fp == NULL)
+    if (fd == -1)
     {
         printf("Could not open %s\n\n", filename);
         return -1;
     }
+
+    if (backend == DISK_BACKEND_MMAP)
+        return map_disk();
     return 0;
 }
 
@@ -95,86 +491,766 @@ int init_disk(char *filename, int block_size, int num_blocks)
 /*-------------------------------------------------------------------*/
 int read_blocks(int start_address, int nblocks, void *buffer)
 {
-    int i, j, e, s;
-    e = 0;
-    s = 0;
+    /*Checks that the data requested is within the range of addresses of the disk*/
+    if (start_address < 0 || start_address + nblocks > MAX_BLOCK)
+    {
+        printf("out of bound error %d\n", start_address);
+        return -1;
+    }
+
+    /*Pause until the device model has served the request*/
+    if (model_request(start_address, nblocks) != 0)
+        return -1;
+
+    /*Mapped image: the blocks are already in memory*/
+    if (NULL != map)
+    {
+        memcpy(buffer, map + (size_t)start_address * BLOCK_SIZE, (size_t)nblocks * BLOCK_SIZE);
+        count_io(0, nblocks);
+        return nblocks;
+    }
+
+    /*All the blocks go straight into the caller's buffer in one pread*/
+    if (pread_full(buffer, (size_t)nblocks * BLOCK_SIZE, (off_t)start_address * BLOCK_SIZE) != 0)
+        return -1;
+    count_io(0, nblocks);
 
-    /*Sets up a temporary buffer*/
-    void* blockRead = (void*) malloc(BLOCK_SIZE);
+    /*If no failure return the number of blocks read*/
+    return nblocks;
+}
 
+/*------------------------------------------------------------------*/
+/*Writes a series of blocks to the disk from the buffer             */
+/*------------------------------------------------------------------*/
+int write_blocks(int start_address, int nblocks, void *buffer)
+{
     /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
+    if (start_address < 0 || start_address + nblocks > MAX_BLOCK)
     {
-        printf("out of bound error %d\n", start_address);
+        printf("out of bound error\n");
+        return -1;
+    }
+
+    /*Pause until the device model has served the request*/
+    if (model_request(start_address, nblocks) != 0)
         return -1;
+
+    /*Mapped image: copy straight in, msync is left to flush_disk/close_disk*/
+    if (NULL != map)
+    {
+        memcpy(map + (size_t)start_address * BLOCK_SIZE, buffer, (size_t)nblocks * BLOCK_SIZE);
+        count_io(1, nblocks);
+        return nblocks;
     }
 
-    /*Goto the data requested from the disk*/
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
+    /*All the blocks come straight from the caller's buffer in one pwrite*/
+    if (pwrite_full(buffer, (size_t)nblocks * BLOCK_SIZE, (off_t)start_address * BLOCK_SIZE) != 0)
+        return -1;
+    count_io(1, nblocks);
+
+    /*If no failure return the number of blocks written*/
+    return nblocks;
+}
+
+/*-------------------------------------------------------------------*/
+/*Gather/scatter: transfers block addresses[i] from/to buffers[i].   */
+/*Runs of consecutive addresses are issued as one preadv/pwritev.    */
+/*-------------------------------------------------------------------*/
+static int transfer_blocks_v(int *addresses, int nblocks, void **buffers, int is_write)
+{
+    int i, j, run;
+
+    /*Checks that every block requested is within the range of addresses of the disk*/
+    for (i = 0; i < nblocks; i++)
+    {
+        if (addresses[i] < 0 || addresses[i] >= MAX_BLOCK)
+        {
+            printf("out of bound error %d\n", addresses[i]);
+            return -1;
+        }
+    }
 
-    /*For every block requested*/
-    for (i = 0; i < nblocks; ++i)
+    for (i = 0; i < nblocks; i += run)
     {
-        /*Pause until the latency duration is elapsed*/
-        // usleep(L);
+        /*Extend the run while the next address follows the previous one*/
+        run = 1;
+        while (i + run < nblocks && addresses[i + run] == addresses[i] + run)
+            run++;
 
-        s++;
-        fread(blockRead, BLOCK_SIZE, 1, fp);
+        /*Each run is one request to the device model*/
+        if (model_request(addresses[i], run) != 0)
+            return -1;
 
-       for (j = 0; j < BLOCK_SIZE; j++)
+        if (NULL != map)
         {
-            memcpy(buffer+(i*BLOCK_SIZE), blockRead, BLOCK_SIZE);  
+            char *base = map + (size_t)addresses[i] * BLOCK_SIZE;
+            for (j = 0; j < run; j++)
+            {
+                if (is_write)
+                    memcpy(base + (size_t)j * BLOCK_SIZE, buffers[i + j], BLOCK_SIZE);
+                else
+                    memcpy(buffers[i + j], base + (size_t)j * BLOCK_SIZE, BLOCK_SIZE);
+            }
         }
+        else if (transfer_run(addresses[i], run, buffers + i, is_write) != 0)
+            return -1;
+        count_io(is_write, run);
     }
+    return nblocks;
+}
+
+int read_blocks_v(int *addresses, int nblocks, void **buffers)
+{
+    return transfer_blocks_v(addresses, nblocks, buffers, 0);
+}
+
+int write_blocks_v(int *addresses, int nblocks, void **buffers)
+{
+    return transfer_blocks_v(addresses, nblocks, buffers, 1);
+}
 
-    free(blockRead);
+/*===================================================================*/
+/*Asynchronous I/O                                                   */
+/*                                                                   */
+/*submit_blocks() queues a transfer and returns at once. Completions */
+/*are reaped by disk_aio_poll()/disk_aio_wait() on the caller's      */
+/*thread, which also runs the done callbacks, so callers never see   */
+/*one from an engine thread. With several threads submitting, a      */
+/*callback runs on whichever of them reaps it. Two engines: io_uring */
+/*when the kernel has it, else a pool of worker threads doing        */
+/*pread/pwrite. Before disk_aio_init transfers are done at           */
+/*submission.                                                        */
+/*                                                                   */
+/*The worker threads (up to one per request in flight), or on a      */
+/*mapped image the reaping caller (see reaper_dispatches), take      */
+/*requests from a scheduler queue rather than in arrival order:      */
+/*  - elevator (C-LOOK): the next request is the lowest one at or    */
+/*    after the block where the last one ended, wrapping around      */
+/*  - deadline: a request queued past its expiry time goes first     */
+/*  - requests of the same kind on adjacent blocks are merged into   */
+/*    one vectored transfer                                          */
+/*A request never passes an earlier one it overlaps unless both are  */
+/*reads: it waits while one is queued before it or still running.    */
+/*io_uring requests go to the kernel as soon as they are not held    */
+/*back that way, in the order the queue gives; the kernel has its    */
+/*own scheduler.                                                     */
+/*===================================================================*/
+static int aio_engine = DISK_AIO_NONE;
+static int aio_depth = 0;
+static int aio_inflight = 0;          /*Submitted and not reaped yet, changed under aio_lock*/
 
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t aio_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t aio_done = PTHREAD_COND_INITIALIZER;
+static disk_io_t *sched_head = NULL, *sched_tail = NULL;  /*Queued for the scheduler, in arrival order*/
+static disk_io_t *running = NULL;                         /*Taken off the queue and not finished yet*/
+static int sched_pos = 0;                                 /*Block after the last request dispatched*/
+static disk_io_t *done_head = NULL, *done_tail = NULL;  /*Finished, waiting to be reaped*/
+static pthread_t workers[AIO_WORKERS];
+static int aio_workers = 0;           /*Started, up to queue_depth of them*/
+static int aio_stop = 0;
 
-    /*If no failure return the number of blocks read, else return the negative number of failures*/
-    if (e == 0)
-        return s;
+static void io_push(disk_io_t **head, disk_io_t **tail, disk_io_t *io)
+{
+    io->next = NULL;
+    if (NULL == *tail)
+        *head = io;
     else
-        return e;
+        (*tail)->next = io;
+    *tail = io;
 }
 
-/*------------------------------------------------------------------*/
-/*Writes a series of blocks to the disk from the buffer             */
-/*------------------------------------------------------------------*/
-int write_blocks(int start_address, int nblocks, void *buffer)
+static disk_io_t *io_pop(disk_io_t **head, disk_io_t **tail)
 {
-    int i, e, s;
-    e = 0;
-    s = 0;
+    disk_io_t *io = *head;
+    if (NULL != io)
+    {
+        *head = io->next;
+        if (NULL == *head)
+            *tail = NULL;
+    }
+    return io;
+}
 
-    void* blockWrite = (void*) malloc(BLOCK_SIZE);
+/*Synchronous transfer of one request, used by the workers and at submission*/
+static int io_transfer(disk_io_t *io)
+{
+    if (io->op == DISK_IO_WRITE)
+        return write_blocks(io->start_address, io->nblocks, io->buffer);
+    return read_blocks(io->start_address, io->nblocks, io->buffer);
+}
 
-    /*Checks that the data requested is within the range of addresses of the disk*/
-    if (start_address + nblocks > MAX_BLOCK)
+/*-------------------------------------------------------------------*/
+/*Whether queued requests wait for a reaping caller to dispatch them.*/
+/*On a mapped image they are memcpys and do, which plugs a batch for */
+/*the elevator; but when the device model makes transfers take real  */
+/*time, the worker threads take them so they overlap.                */
+/*-------------------------------------------------------------------*/
+static int reaper_dispatches()
+{
+    return NULL != map && !(aio_engine == DISK_AIO_THREADS && __atomic_load_n(&model_sleeps, __ATOMIC_ACQUIRE));
+}
+
+/*Queued requests may have changed hands*/
+static void aio_model_changed()
+{
+    pthread_mutex_lock(&aio_lock);
+    pthread_cond_broadcast(&aio_work);
+    pthread_mutex_unlock(&aio_lock);
+}
+
+static void io_finished(disk_io_t *io, int result)
+{
+    disk_io_t **q;
+
+    io->result = result;
+    pthread_mutex_lock(&aio_lock);
+    for (q = &running; NULL != *q; q = &(*q)->next)
     {
-        printf("out of bound error\n");
-        return -1;
+        if (*q == io)
+        {
+            *q = io->next;
+            break;
+        }
+    }
+    io_push(&done_head, &done_tail, io);
+    pthread_cond_broadcast(&aio_done);
+    /*Requests it held back may go now*/
+    if (NULL != sched_head && !reaper_dispatches())
+        pthread_cond_broadcast(&aio_work);
+    pthread_mutex_unlock(&aio_lock);
+}
+
+/*Whether two requests overlap and one is a write*/
+static int io_conflict(disk_io_t *a, disk_io_t *b)
+{
+    return (a->op == DISK_IO_WRITE || b->op == DISK_IO_WRITE) &&
+        a->start_address < b->start_address + b->nblocks &&
+        b->start_address < a->start_address + a->nblocks;
+}
+
+/*Whether io must wait for a request queued before it or still running*/
+static int sched_blocked(disk_io_t *io)
+{
+    disk_io_t *q;
+
+    for (q = sched_head; q != io; q = q->next)
+        if (io_conflict(q, io))
+            return 1;
+    for (q = running; NULL != q; q = q->next)
+        if (io_conflict(q, io))
+            return 1;
+    return 0;
+}
+
+static void sched_remove(disk_io_t *io)
+{
+    disk_io_t *prev = NULL, *q;
+
+    for (q = sched_head; q != io; q = q->next)
+        prev = q;
+    if (NULL == prev)
+        sched_head = io->next;
+    else
+        prev->next = io->next;
+    if (sched_tail == io)
+        sched_tail = prev;
+}
+
+/*Next request to dispatch: the most overdue one, else the elevator's next stop*/
+static disk_io_t *sched_pick()
+{
+    disk_io_t *io, *expired = NULL, *next = NULL, *lowest = NULL;
+    long long now = now_us();
+
+    for (io = sched_head; NULL != io; io = io->next)
+    {
+        if (sched_blocked(io))
+            continue;
+        if (io->deadline <= now && (NULL == expired || io->deadline < expired->deadline))
+            expired = io;
+        if (io->start_address >= sched_pos && (NULL == next || io->start_address < next->start_address))
+            next = io;
+        if (NULL == lowest || io->start_address < lowest->start_address)
+            lowest = io;
+    }
+    if (NULL != expired)
+        return expired;
+    return NULL != next ? next : lowest;
+}
+
+/*-------------------------------------------------------------------*/
+/*Takes the next request off the queue, with the requests of the     */
+/*same kind that continue it block after block, and counts them as   */
+/*running. Called with aio_lock held. Returns how many went into     */
+/*batch, 0 if every queued request is held back                     */
+/*-------------------------------------------------------------------*/
+static int sched_next(disk_io_t **batch)
+{
+    disk_io_t *io = sched_pick();
+    int n = 0, blocks = 0;
+    int end = sched_pos;
+
+    while (NULL != io)
+    {
+        sched_remove(io);
+        io->next = running;
+        running = io;
+        batch[n++] = io;
+        blocks += io->nblocks;
+        end = io->start_address + io->nblocks;
+
+        for (io = sched_head; NULL != io; io = io->next)
+        {
+            if (io->op == batch[0]->op && io->start_address == end &&
+                blocks + io->nblocks <= SCHED_MAX_MERGE && !sched_blocked(io))
+                break;
+        }
+    }
+    sched_pos = end;
+    return n;
+}
+
+/*Transfers a batch from sched_next() as one request, then finishes each part*/
+static void sched_dispatch(disk_io_t **batch, int n)
+{
+    int addresses[SCHED_MAX_MERGE];
+    void *buffers[SCHED_MAX_MERGE];
+    int i, j, blocks = 0, result;
+
+    if (n == 1)
+    {
+        io_finished(batch[0], io_transfer(batch[0]));
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        for (j = 0; j < batch[i]->nblocks; j++)
+        {
+            addresses[blocks] = batch[i]->start_address + j;
+            buffers[blocks] = (char*)batch[i]->buffer + (size_t)j * BLOCK_SIZE;
+            blocks++;
+        }
+    }
+
+    result = transfer_blocks_v(addresses, blocks, buffers, batch[0]->op == DISK_IO_WRITE);
+    for (i = 0; i < n; i++)
+        io_finished(batch[i], result < 0 ? -1 : batch[i]->nblocks);
+}
+
+/*Dispatches everything queued on the calling thread (mapped image: memcpys)*/
+static void sched_run()
+{
+    disk_io_t *batch[SCHED_MAX_MERGE];
+    int n;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&aio_lock);
+        n = NULL != sched_head ? sched_next(batch) : 0;
+        pthread_mutex_unlock(&aio_lock);
+        if (n == 0)
+            return;
+        sched_dispatch(batch, n);
     }
+}
+
+/*Whether a worker has something to dispatch*/
+static int sched_ready()
+{
+    return NULL != sched_head && !reaper_dispatches() && NULL != sched_pick();
+}
+
+static void *aio_worker(void *arg)
+{
+    disk_io_t *batch[SCHED_MAX_MERGE];
+    int n;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&aio_lock);
+        while (!sched_ready() && !aio_stop)
+            pthread_cond_wait(&aio_work, &aio_lock);
+        n = sched_ready() ? sched_next(batch) : 0;
+        pthread_mutex_unlock(&aio_lock);
+
+        if (n == 0)
+            return NULL;
+        sched_dispatch(batch, n);
+    }
+}
+
+#ifdef HAVE_IO_URING
+/*-------------------------------------------------------------------*/
+/*io_uring through the raw system calls: one submission ring, one    */
+/*completion ring, user_data holds the disk_io_t                     */
+/*-------------------------------------------------------------------*/
+static struct
+{
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_size, cq_size, sqes_size;
+    int pending;                      /*Submitted to the kernel, completion not reaped*/
+} ring = { -1 };
 
-    /*Goto where the data is to be written on the disk*/        
-    fseek(fp, start_address * BLOCK_SIZE, SEEK_SET);
+/*Serializes the rings between threads; held across a wait for completions*/
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    /*For every block requested*/        
-    for (i = 0; i < nblocks; ++i)
+static int uring_setup(int entries)
+{
+    struct io_uring_params params;
+    char *sq, *cq;
+
+    memset(&params, 0, sizeof(params));
+    ring.fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring.fd < 0)
     {
-        /*Pause until the latency duration is elapsed*/
-        usleep(L);
+        ring.fd = -1;
+        return -1;
+    }
 
-        memcpy(blockWrite, buffer+(i*BLOCK_SIZE), BLOCK_SIZE);
+    ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
 
-        fwrite(blockWrite, BLOCK_SIZE, 1, fp);
-        fflush(fp);
-        s++;
+    ring.sq_ring = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_ring = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sq_ring == MAP_FAILED || ring.cq_ring == MAP_FAILED || ring.sqes == MAP_FAILED)
+    {
+        if (ring.sq_ring != MAP_FAILED) munmap(ring.sq_ring, ring.sq_size);
+        if (ring.cq_ring != MAP_FAILED) munmap(ring.cq_ring, ring.cq_size);
+        if (ring.sqes != MAP_FAILED) munmap(ring.sqes, ring.sqes_size);
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
     }
-    free(blockWrite);
 
-    /*If no failure return the number of blocks written, else return the negative number of failures*/
-    if (e == 0)
-        return s;
+    sq = ring.sq_ring;
+    cq = ring.cq_ring;
+    ring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown()
+{
+    if (ring.fd == -1)
+        return;
+    munmap(ring.sq_ring, ring.sq_size);
+    munmap(ring.cq_ring, ring.cq_size);
+    munmap(ring.sqes, ring.sqes_size);
+    close(ring.fd);
+    ring.fd = -1;
+    ring.pending = 0;
+}
+
+/*Returns 0 once the kernel has the request, -1 if it is not in the ring*/
+static int uring_submit(disk_io_t *io)
+{
+    unsigned tail, index;
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    pthread_mutex_lock(&uring_lock);
+    tail = *ring.sq_tail;
+    index = tail & *ring.sq_mask;
+    sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = io->op == DISK_IO_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)io->buffer;
+    sqe->len = (unsigned)((size_t)io->nblocks * BLOCK_SIZE);
+    sqe->off = (uint64_t)io->start_address * BLOCK_SIZE;
+    sqe->user_data = (uint64_t)(uintptr_t)io;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    do
+        ret = (int)syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0);
+    while (ret < 0 && errno == EINTR);
+
+    /*The kernel only reads the ring inside io_uring_enter: an entry it did not*/
+    /*consume is taken back, so the caller can do the transfer itself          */
+    if (ret == 1)
+        ring.pending++;
     else
-        return e;
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&uring_lock);
+    return ret == 1 ? 0 : -1;
+}
+
+/*Hands the kernel every queued request that is not held back*/
+static void uring_kick()
+{
+    disk_io_t *io;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&aio_lock);
+        io = NULL != sched_head && NULL == map ? sched_pick() : NULL;
+        if (NULL != io)
+        {
+            sched_remove(io);
+            io->next = running;
+            running = io;
+        }
+        pthread_mutex_unlock(&aio_lock);
+        if (NULL == io)
+            return;
+        if (uring_submit(io) != 0)
+            io_finished(io, io_transfer(io));
+    }
+}
+
+/*Moves every completion from the ring to the done list; waits for one if asked*/
+static void uring_reap(int wait)
+{
+    unsigned head;
+    struct io_uring_cqe *cqe;
+    disk_io_t *io;
+    size_t length, done;
+    int ret;
+
+    pthread_mutex_lock(&uring_lock);
+    /*Another thread may have reaped ours already: only wait on the kernel for a completion still owed*/
+    if (wait && ring.pending > 0 && *ring.cq_head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+        syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+    head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+    {
+        cqe = &ring.cqes[head & *ring.cq_mask];
+        io = (disk_io_t*)(uintptr_t)cqe->user_data;
+        length = (size_t)io->nblocks * BLOCK_SIZE;
+        done = cqe->res > 0 ? (size_t)cqe->res : 0;
+        head++;
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        ring.pending--;
+
+        /*A short transfer (or an opcode the kernel lacks) is finished synchronously*/
+        ret = 0;
+        if (done < length)
+        {
+            if (io->op == DISK_IO_WRITE)
+                ret = pwrite_full((char*)io->buffer + done, length - done, (off_t)io->start_address * BLOCK_SIZE + done);
+            else
+                ret = pread_full((char*)io->buffer + done, length - done, (off_t)io->start_address * BLOCK_SIZE + done);
+        }
+        if (ret == 0)
+            count_io(io->op == DISK_IO_WRITE, io->nblocks);
+        io_finished(io, ret == 0 ? io->nblocks : -1);
+    }
+    pthread_mutex_unlock(&uring_lock);
+}
+#endif
+
+/*-------------------------------------------------------------------*/
+/*Starts the engine with up to queue_depth requests in flight.       */
+/*DISK_AIO_URING falls back to threads if io_uring is unavailable,   */
+/*or if a device model is set.                                       */
+/*Returns the engine started, or -1 on error.                        */
+/*-------------------------------------------------------------------*/
+int disk_aio_init(int queue_depth, int engine)
+{
+    disk_aio_shutdown();
+    if (queue_depth < 1)
+        return -1;
+    aio_depth = queue_depth;
+
+#ifdef HAVE_IO_URING
+    /*The kernel does io_uring transfers, out of the device model's reach*/
+    if (engine == DISK_AIO_URING && !__atomic_load_n(&model_on, __ATOMIC_ACQUIRE) && uring_setup(queue_depth) == 0)
+    {
+        aio_engine = DISK_AIO_URING;
+        return aio_engine;
+    }
+#endif
+
+    /*Each worker waits out one transfer at a time: as many as the queue is deep overlap them all*/
+    aio_stop = 0;
+    for (aio_workers = 0; aio_workers < queue_depth && aio_workers < AIO_WORKERS; aio_workers++)
+    {
+        if (pthread_create(&workers[aio_workers], NULL, aio_worker, NULL) != 0)
+        {
+            printf("Could not start disk I/O worker\n\n");
+            aio_engine = DISK_AIO_THREADS;
+            disk_aio_shutdown();
+            return -1;
+        }
+    }
+    aio_engine = DISK_AIO_THREADS;
+    return aio_engine;
+}
+
+/*Waits for everything in flight, then stops the engine*/
+void disk_aio_shutdown()
+{
+    int i;
+
+    disk_aio_drain();
+    if (aio_engine == DISK_AIO_THREADS)
+    {
+        pthread_mutex_lock(&aio_lock);
+        aio_stop = 1;
+        pthread_cond_broadcast(&aio_work);
+        pthread_mutex_unlock(&aio_lock);
+        for (i = 0; i < aio_workers; i++)
+            pthread_join(workers[i], NULL);
+        aio_workers = 0;
+    }
+#ifdef HAVE_IO_URING
+    uring_teardown();
+#endif
+    aio_engine = DISK_AIO_NONE;
+}
+
+int disk_aio_engine()
+{
+    return aio_engine;
+}
+
+int disk_aio_inflight()
+{
+    int n;
+
+    pthread_mutex_lock(&aio_lock);
+    n = aio_inflight;
+    pthread_mutex_unlock(&aio_lock);
+    return n;
+}
+
+/*Reaps every finished request, waiting for one first if asked. Returns how many*/
+static int aio_reap(int wait)
+{
+    disk_io_t *io;
+    int n = 0;
+
+    if (reaper_dispatches())
+        sched_run();
+
+#ifdef HAVE_IO_URING
+    if (aio_engine == DISK_AIO_URING)
+    {
+        pthread_mutex_lock(&aio_lock);
+        wait = wait && NULL == done_head;
+        pthread_mutex_unlock(&aio_lock);
+        uring_reap(wait);
+        uring_kick();
+        wait = 0;
+    }
+#endif
+
+    for (;;)
+    {
+        /*A single wait: another thread may reap what we were waiting for, so callers recheck*/
+        pthread_mutex_lock(&aio_lock);
+        if (wait && n == 0 && NULL == done_head && aio_inflight > 0)
+            pthread_cond_wait(&aio_done, &aio_lock);
+        wait = 0;
+        io = io_pop(&done_head, &done_tail);
+        if (NULL != io)
+        {
+            /*complete is set before the callback, which may submit again.*/
+            /*Waiters are woken now: the callback may need a lock they hold*/
+            aio_inflight--;
+            __atomic_store_n(&io->complete, 1, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&aio_done);
+        }
+        pthread_mutex_unlock(&aio_lock);
+
+        if (NULL == io)
+            return n;
+
+        if (NULL != io->done)
+            io->done(io);
+        n++;
+    }
+}
+
+/*-------------------------------------------------------------------*/
+/*Queues a transfer of nblocks starting at start_address. The caller */
+/*keeps io and its buffer alive until it completes. If queue_depth   */
+/*requests are already in flight, waits for one to finish first.     */
+/*Returns 0 on success, -1 if the request is invalid.                */
+/*-------------------------------------------------------------------*/
+int submit_blocks(disk_io_t *io)
+{
+    if (io->start_address < 0 || io->nblocks < 1 || io->start_address + io->nblocks > MAX_BLOCK)
+    {
+        printf("out of bound error %d\n", io->start_address);
+        return -1;
+    }
+
+    io->complete = 0;
+    io->result = 0;
+    pthread_mutex_lock(&aio_lock);
+    while (aio_engine != DISK_AIO_NONE && aio_inflight >= aio_depth)
+    {
+        pthread_mutex_unlock(&aio_lock);
+        aio_reap(1);
+        pthread_mutex_lock(&aio_lock);
+    }
+    aio_inflight++;
+    pthread_mutex_unlock(&aio_lock);
+
+    if (aio_engine == DISK_AIO_NONE)
+    {
+        io_finished(io, io_transfer(io));
+        return 0;
+    }
+
+    /*Queued for a worker, or for the next reap (see reaper_dispatches)*/
+    pthread_mutex_lock(&aio_lock);
+    io->deadline = now_us() + (io->op == DISK_IO_READ ? SCHED_READ_EXPIRE : SCHED_WRITE_EXPIRE);
+    io_push(&sched_head, &sched_tail, io);
+    if (!reaper_dispatches())
+        pthread_cond_signal(&aio_work);
+    pthread_mutex_unlock(&aio_lock);
+
+#ifdef HAVE_IO_URING
+    if (aio_engine == DISK_AIO_URING && NULL == map)
+        uring_kick();
+#endif
+    return 0;
+}
+
+/*Runs the callbacks of the finished requests without blocking. Returns how many*/
+int disk_aio_poll()
+{
+    return aio_reap(0);
+}
+
+/*Blocks until io is complete. Returns its result: blocks transferred, or -1*/
+int disk_aio_wait(disk_io_t *io)
+{
+    while (!__atomic_load_n(&io->complete, __ATOMIC_ACQUIRE))
+        aio_reap(1);
+    return io->result;
+}
+
+/*Blocks until at least one request finishes, if any is in flight. Returns how many were reaped*/
+int disk_aio_wait_any()
+{
+    if (disk_aio_inflight() == 0)
+        return 0;
+    return aio_reap(1);
+}
+
+/*Blocks until nothing is in flight*/
+void disk_aio_drain()
+{
+    while (disk_aio_inflight() > 0)
+        aio_reap(1);
 }
@@ -1,5 +1,87 @@
+#define DISK_BACKEND_PIO	0	// positional pread/pwrite on the image file
+#define DISK_BACKEND_MMAP	1	// whole image mapped, blocks are plain memcpys
+
 int init_fresh_disk(char *filename, int block_size, int num_blocks);
 int init_disk(char *filename, int block_size, int num_blocks);
+int init_fresh_disk_backend(char *filename, int block_size, int num_blocks, int disk_backend);
+int init_disk_backend(char *filename, int block_size, int num_blocks, int disk_backend);
 int read_blocks(int start_address, int nblocks, void *buffer);
 int write_blocks(int start_address, int nblocks, void *buffer);
+int read_blocks_v(int *addresses, int nblocks, void **buffers);
+int write_blocks_v(int *addresses, int nblocks, void **buffers);
+void *map_blocks(int start_address, int nblocks);
+int flush_disk();
 int close_disk();
+
+// Simulated device. Every transfer is delayed by its service time:
+//	latency (drawn from latency_dist) + seek (by distance from the last
+//	block transferred) + bytes / bandwidth
+// on one of queue_depth channels, and each attempt fails with probability
+// fail_rate, up to max_retry retries. Zero fields cost nothing.
+#define DISK_LATENCY_FIXED		0	// always latency_us
+#define DISK_LATENCY_UNIFORM	1	// latency_us +- jitter_us
+#define DISK_LATENCY_EXP		2	// exponential with mean latency_us, plus jitter_us
+
+typedef struct _disk_model_t {
+	int latency_dist;
+	int latency_us;		// per request
+	int jitter_us;
+	int bandwidth_kbs;	// KB/s, 0 = unlimited
+	int queue_depth;	// requests served at once, 0 = unlimited
+	int seek_min_us;	// moving to another block at all
+	int seek_max_us;	// moving across the whole disk; in between it grows linearly
+	double fail_rate;	// chance that one attempt fails
+	int max_retry;		// retries of a failed attempt before the transfer fails
+	unsigned int seed;	// random numbers repeat for the same seed
+	int virtual_time;	// 1: never sleep, only advance disk_model_clock()
+} disk_model_t;
+
+extern const disk_model_t disk_model_hdd;	// 7200 rpm disk
+extern const disk_model_t disk_model_ssd;	// SATA flash
+
+// transfers done so far, as requests to the device and blocks moved
+typedef struct _disk_stats_t {
+	long reads;
+	long writes;
+	long blocks_read;
+	long blocks_written;
+} disk_stats_t;
+
+void disk_get_stats(disk_stats_t *stats);
+void disk_reset_stats();
+
+void disk_set_model(const disk_model_t *model);	// NULL: no delays, no failures
+long long disk_model_clock();	// device time in microseconds since disk_set_model
+int disk_model_retries();		// failed attempts since disk_set_model
+
+// Asynchronous block I/O. Completions are reaped, and their callbacks run,
+// on the caller's thread inside disk_aio_poll() and disk_aio_wait().
+#define DISK_AIO_NONE		0	// no engine started: requests complete at submission
+#define DISK_AIO_URING		1	// io_uring
+#define DISK_AIO_THREADS	2	// worker threads doing pread/pwrite
+
+#define DISK_IO_READ	0
+#define DISK_IO_WRITE	1
+
+typedef struct _disk_io_t {
+	int op;				// DISK_IO_READ or DISK_IO_WRITE
+	int start_address;
+	int nblocks;
+	void *buffer;
+	void (*done)(struct _disk_io_t *io);	// may be NULL
+	void *arg;			// left to the caller
+	int result;			// blocks transferred, or -1; valid once complete
+	int complete;
+	long long deadline;			// used by the engine
+	struct _disk_io_t *next;	// used by the engine
+} disk_io_t;
+
+int  disk_aio_init(int queue_depth, int engine);
+void disk_aio_shutdown();
+int  disk_aio_engine();
+int  disk_aio_inflight();
+int  submit_blocks(disk_io_t *io);
+int  disk_aio_poll();
+int  disk_aio_wait(disk_io_t *io);
+int  disk_aio_wait_any();
+void disk_aio_drain();
@@ -0,0 +1,19 @@
+#ifndef FNV_H
+#define FNV_H
+
+#include <stddef.h>
+
+// 32-bit FNV-1a, for the in-memory hash tables and the on-disk checksums.
+// Start from FNV_SEED; data in several pieces hashes like one piece if each
+// call is given the result of the one before.
+#define FNV_SEED	2166136261u
+#define FNV_PRIME	16777619u
+
+static inline unsigned int fnv1a(unsigned int h, const void *data, size_t len) {
+	const unsigned char *p = (const unsigned char*)data;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ p[i]) * FNV_PRIME;
+	return h;
+}
+
+#endif
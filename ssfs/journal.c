@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "journal.h"
+#include "block_cache.h"
+#include "disk_emu.h"
+#include "fnv.h"
+
+typedef struct _journal_header_t {
+	unsigned char magic[4];	// "JRNL"
+	int start_seq;			// first valid transaction; older ones are stale
+} journal_header_t;
+
+typedef struct _tx_header_t {
+	unsigned char magic[4];	// "JTX1"
+	int seq;
+	int count;				// number of block images following the header
+	unsigned int checksum;	// over home[] and the images, makes the tx its own commit record
+	int home[];				// where each image belongs
+} tx_header_t;
+
+static int start = -1;		// first block of the journal region
+static int nblocks = 0;
+static int bsize = 0;
+static int head = 1;		// next free block in the region (block 0 is the header)
+static int seq = 1;			// sequence number of the next transaction
+static int max_tx = 0;		// most images a single transaction can hold
+
+// transaction being built: header block followed by the images, ready to write in one go
+static char *tx_buf = NULL;
+static int tx_count = 0;
+
+// images committed to the journal but not yet written to their home locations
+static int *ckpt_home = NULL;
+static char *ckpt_data = NULL;
+static int ckpt_count = 0;
+
+static tx_header_t *tx_header() {
+	return (tx_header_t*)tx_buf;
+}
+
+static char *tx_image(int i) {
+	return tx_buf + (size_t)(i + 1) * bsize;
+}
+
+// FNV-1a over home[], then the images
+static unsigned int checksum(tx_header_t *tx, char *images) {
+	unsigned int h = fnv1a(FNV_SEED, tx->home, tx->count * sizeof(int));
+	return fnv1a(h, images, (size_t)tx->count * bsize);
+}
+
+static int write_header(int start_seq) {
+	char *buf = (char*)calloc(1, bsize);
+	journal_header_t *jh = (journal_header_t*)buf;
+	memcpy(jh->magic, "JRNL", 4);
+	jh->start_seq = start_seq;
+
+	int ret = write_blocks(start, 1, buf) == 1 ? 0 : -1;
+	free(buf);
+	if (flush_disk() != 0)
+		ret = -1;
+	return ret;
+}
+
+/*
+ * writes every committed image to its home location and empties the region.
+ * returns 0 on success, -1 on error.
+ */
+static int checkpoint() {
+	for (int i = 0; i < ckpt_count; i++)
+		if (cache_write(ckpt_home[i], 1, ckpt_data + (size_t)i * bsize) != 1)
+			return -1;
+
+	// home locations must be on disk before the transactions are dropped
+	if (cache_flush() != 0)
+		return -1;
+
+	ckpt_count = 0;
+	head = 1;
+	return write_header(seq);
+}
+
+/*
+ * sets up the journal over blocks [start, start + nblocks) of the disk.
+ * returns 0 on success, -1 on error.
+ */
+int journal_init(int region_start, int region_blocks, int block_size) {
+	journal_destroy();
+
+	int home_slots = (block_size - (int)sizeof(tx_header_t)) / (int)sizeof(int);
+	if (region_blocks < 3 || home_slots < 1) {
+		fprintf(stderr, "Error: Journal of %d blocks is too small\n", region_blocks);
+		return -1;
+	}
+
+	start = region_start;
+	nblocks = region_blocks;
+	bsize = block_size;
+	max_tx = nblocks - 2 < home_slots ? nblocks - 2 : home_slots;
+
+	tx_buf = (char*)calloc(max_tx + 1, bsize);
+	ckpt_home = (int*)malloc(nblocks * sizeof(int));
+	ckpt_data = (char*)malloc((size_t)nblocks * bsize);
+	tx_count = 0;
+	ckpt_count = 0;
+	head = 1;
+	seq = 1;
+	return 0;
+}
+
+void journal_destroy() {
+	free(tx_buf);
+	free(ckpt_home);
+	free(ckpt_data);
+	tx_buf = NULL;
+	ckpt_home = NULL;
+	ckpt_data = NULL;
+	tx_count = 0;
+	ckpt_count = 0;
+	start = -1;
+}
+
+// writes an empty journal; used when formatting a new disk
+int journal_format() {
+	tx_count = 0;
+	ckpt_count = 0;
+	head = 1;
+	seq = 1;
+	return write_header(seq);
+}
+
+/*
+ * replays every complete transaction found in the region into the home
+ * locations, then empties the region.
+ * returns the number of transactions replayed, or -1 on error.
+ */
+int journal_recover() {
+	char *buf = (char*)malloc((size_t)(max_tx + 1) * bsize);
+	journal_header_t *jh = (journal_header_t*)buf;
+	tx_header_t *tx = (tx_header_t*)buf;
+	int replayed = 0;
+
+	if (read_blocks(start, 1, buf) != 1) {
+		free(buf);
+		return -1;
+	}
+
+	// no journal on this disk yet
+	if (memcmp(jh->magic, "JRNL", 4) != 0) {
+		free(buf);
+		return journal_format() == 0 ? 0 : -1;
+	}
+
+	seq = jh->start_seq;
+	for (int pos = 1; pos < nblocks; pos += 1 + tx->count) {
+		if (read_blocks(start + pos, 1, buf) != 1)
+			break;
+		if (memcmp(tx->magic, "JTX1", 4) != 0 || tx->seq != seq ||
+			tx->count < 1 || tx->count > max_tx || pos + 1 + tx->count > nblocks)
+			break;
+		if (read_blocks(start + pos + 1, tx->count, buf + bsize) != tx->count)
+			break;
+
+		// a torn write leaves a checksum mismatch: the tx never committed
+		if (tx->checksum != checksum(tx, buf + bsize))
+			break;
+
+		for (int i = 0; i < tx->count; i++)
+			cache_write(tx->home[i], 1, buf + (size_t)(i + 1) * bsize);
+		replayed++;
+		seq++;
+	}
+	free(buf);
+
+	if (replayed > 0 && cache_flush() != 0)
+		return -1;
+
+	head = 1;
+	ckpt_count = 0;
+	if (write_header(seq) != 0)
+		return -1;
+	return replayed;
+}
+
+/*
+ * adds the image of a metadata block to the current transaction.
+ * logging the same home block again replaces its image.
+ * returns 0 on success, -1 on error.
+ */
+int journal_log(int home, void *block) {
+	int i;
+	for (i = 0; i < tx_count; i++)
+		if (tx_header()->home[i] == home)
+			break;
+
+	if (i == tx_count) {
+		if (tx_count == max_tx && journal_commit() != 0)
+			return -1;
+		i = tx_count++;
+		tx_header()->home[i] = home;
+	}
+	memcpy(tx_image(i), block, bsize);
+	return 0;
+}
+
+/*
+ * appends the current transaction to the region as one sequential write.
+ * returns 0 on success, -1 on error.
+ */
+int journal_commit() {
+	if (tx_count == 0)
+		return 0;
+
+	if (head + 1 + tx_count > nblocks && checkpoint() != 0)
+		return -1;
+
+	// ordered mode: file data must be on disk before the metadata that points to it
+	if (cache_flush() != 0)
+		return -1;
+
+	tx_header_t *tx = tx_header();
+	memcpy(tx->magic, "JTX1", 4);
+	tx->seq = seq;
+	tx->count = tx_count;
+	tx->checksum = checksum(tx, tx_image(0));
+
+	if (write_blocks(start + head, 1 + tx_count, tx_buf) != 1 + tx_count)
+		return -1;
+	if (flush_disk() != 0)
+		return -1;
+
+	// remember the newest image of each block for the next checkpoint
+	for (int i = 0; i < tx_count; i++) {
+		int j;
+		for (j = 0; j < ckpt_count; j++)
+			if (ckpt_home[j] == tx->home[i])
+				break;
+		if (j == ckpt_count) {
+			ckpt_home[ckpt_count] = tx->home[i];
+			ckpt_count++;
+		}
+		memcpy(ckpt_data + (size_t)j * bsize, tx_image(i), bsize);
+	}
+
+	head += 1 + tx_count;
+	seq++;
+	tx_count = 0;
+	return 0;
+}
+
+/*
+ * copies the newest logged image of `home` into block, if the journal has one.
+ * metadata reads must check here first: home locations are stale until
+ * the next checkpoint.
+ * returns 1 if found, 0 otherwise.
+ */
+int journal_lookup(int home, void *block) {
+	for (int i = 0; i < tx_count; i++) {
+		if (tx_header()->home[i] == home) {
+			memcpy(block, tx_image(i), bsize);
+			return 1;
+		}
+	}
+	for (int i = 0; i < ckpt_count; i++) {
+		if (ckpt_home[i] == home) {
+			memcpy(block, ckpt_data + (size_t)i * bsize, bsize);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// commits whatever is pending and moves everything to its home location
+int journal_checkpoint() {
+	if (start == -1)
+		return 0;
+	if (journal_commit() != 0)
+		return -1;
+	if (ckpt_count == 0 && head == 1)
+		return 0;
+	return checkpoint();
+}
@@ -0,0 +1,23 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// Metadata journal kept in a reserved region of the disk.
+// Block images logged with journal_log() are gathered into one transaction
+// and appended to the region by journal_commit() as a single sequential
+// write. They reach their home locations only at journal_checkpoint(),
+// which runs when the region fills up. After a crash, journal_recover()
+// replays every complete transaction. Metadata reads consult
+// journal_lookup() first, since home locations lag behind until checkpoint.
+//
+// Region layout:	[journal header][tx header][blocks...][tx header][blocks...]...
+
+int  journal_init(int start, int nblocks, int block_size);
+void journal_destroy();
+int  journal_format();
+int  journal_recover();
+int  journal_log(int home, void *block);
+int  journal_commit();
+int  journal_checkpoint();
+int  journal_lookup(int home, void *block);
+
+#endif
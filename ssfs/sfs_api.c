@@ -1,23 +1,42 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stddef.h>		// offsetof
+#include <limits.h>
 #include <unistd.h> 	// dup
+#include <pthread.h>
+#include <time.h>
 #include "sfs_api.h"
 #include "disk_emu.h"
+#include "block_cache.h"
+#include "journal.h"
+#include "fnv.h"
 
-#define BLOCK_SIZE			1024
-#define BLOCK_SIZE_NULL_T	1025	// null terminated block
-#define NUM_BLOCKS			1024
 #define NUM_DIRECT_BLOCKS	14
+#define MAP_CACHE_SLOTS		2	// map blocks kept per open file: a double-indirect block and one of its leaves
+#define MAX_IO_BLOCKS		64	// blocks moved per cache_read/cache_write in fread/fwrite
+#define MIN_READAHEAD_BLOCKS	4	// read-ahead window once reads look sequential
+#define MAX_READAHEAD_BLOCKS	64	// the window doubles on each sequential read up to this
 #define MAX_OPEN_FILES		200
-#define MAX_INODES			72 	// 1021 available blocks / 14 blocks per i-node
-								// = 72.9 ~ 72 files
+#define MIN_BLOCK_SIZE		512	// the superblock must fit in one block
+#define MAX_BLOCK_SIZE		65536
+#define DEFAULT_CACHE_BLOCKS	256	// 256 blocks of cache
+#define JOURNAL_BLOCKS		32	// metadata journal, right after the superblock
+#define JOURNAL_GROUP_OPS	16	// operations batched into one journal commit
+#define ASYNC_QUEUE_DEPTH	32	// disk transfers the async calls keep in flight
+#define NUM_SHADOWS		4	// snapshots kept; a commit past that drops the oldest
+#define PATH_CACHE_SLOTS	1024	// directory paths remembered by resolve_parent, a power of two
+#define ROOT_DIR		-1	// parent of the entries at the top level
+#define SSFS_MAGIC		"SSFS"
+#define SSFS_VERSION	3	// on-disk format; mount refuses newer ones
 
 typedef struct _inode_t {
 	// ints are 32 bits long
 	int size;
 	int direct[NUM_DIRECT_BLOCKS];
-	int indirect;
+	int indirect;			// block of ptrs_per_block pointers to data blocks
+	int double_indirect;	// block of pointers to indirect blocks
 } inode_t;
 
 typedef struct _superblock_t {
@@ -27,37 +46,49 @@ typedef struct _superblock_t {
 	int dir_block_size;
 	int no_of_inodes;
 	inode_t root; // j-node
-	inode_t shadow[4];
-	int last_shadow;
+	inode_t shadow[NUM_SHADOWS];	// snapshot roots: the blocks holding each frozen copy of the dir
+	int last_shadow;	// snapshot the live dir was last committed as or restored from, -1 if none
+	int journal_start;	// 0 on disks formatted without a journal
+	int journal_blocks;
+	int num_blocks;		// 0 on disks formatted before the geometry was stored
+	int max_inodes;
+	int commits;		// number of the last ssfs_commit
+	int shadow_cnum[NUM_SHADOWS];	// commit number held by each shadow, 0 if empty
+	int ibm_start;		// first block of the inode bitmap
+	int version;		// SSFS_VERSION of the code that formatted the disk
+	unsigned int checksum;	// FNV-1a of the fields above, see write_superblock
 } superblock_t;
 
-typedef struct _block_t {
-	unsigned char bytes[BLOCK_SIZE];
-} block_t;
-
-typedef struct _bit_array_t {
-	// 1024 bit vector is the same as 32 ints * 32 bits 
-	int four_bytes[32];
-} bit_array_t;
-
 typedef struct _dir_entry_t {
-	char filename[10];
+	char filename[SSFS_MAX_NAME + 1];
+	char is_dir;	// a directory's inode has no blocks; its size is the number of entries in it
+	char filler;	// needed to reach 32 bytes
 	int inode_no;	// use int for easier inode # tracking; 4 bytes
-	char filler[2]; // needed to reach 16 bytes
+	int parent;		// inode of the directory holding it, ROOT_DIR at the top level
 } dir_entry_t;
 
+// followed by max_inodes dir entries from the next block boundary on, see dir_entries
 typedef struct _directory_t {
 	int full;
 	int size;
-	inode_t files[MAX_INODES];
-	dir_entry_t entries[MAX_INODES];
+	inode_t files[];	// max_inodes of them
 } directory_t;
 
+typedef struct _map_cache_t {
+	int block;		// map block held here, -1 if none
+	int *ptrs;
+} map_cache_t;
+
 typedef struct _fd_entry_t {
 	int inode_no;
 	inode_t inode;
 	int read_ptr;
 	int write_ptr;
+	map_cache_t maps[MAP_CACHE_SLOTS];	// most recently used first
+	int ra_next;	// block a sequential read would start in
+	int ra_window;	// blocks read ahead past each request, 0 while reads look random
+	int ra_end;		// blocks before this one have already been read ahead
+	pthread_mutex_t lock;	// held for the whole of a call on this fd
 } fd_entry_t;
 
 typedef struct _open_fd_table_t {
@@ -65,208 +96,678 @@ typedef struct _open_fd_table_t {
 	fd_entry_t entries[MAX_OPEN_FILES];
 } open_fd_table_t;
 
+// helpers working on the types above
+static int open_file(char *path);
+static int remove_file(char *path);
+static int resolve_parent(char *path, int *parent, char *name);
+static int create_entry(int parent, char *name, int is_dir);
+static void free_entry(int ino);
+static void path_cache_clear();
+static long now_ns();
+static void time_call(ssfs_latency_t *lat, long start);
+static int fwrite_locked(int fileID, char *buf, int length, int *pos);
+static int fread_locked(int fileID, char *buf, int length, int *pos);
+static int allocate_file_blocks(int fileID, int first, int last);
+static int map_blocks_needed(inode_t *inode, int first, int last);
+static int contiguous_run(int fileID, int i, int last);
+static int bmap(int fileID, int lblk);
+static int bmap_set(int fileID, int lblk, int phys);
+static void drop_maps(int fileID);
+static void read_ahead(int fileID, int first, int last);
+static int write_partial_block(int block, int old, int offset, char *src, int len, char *tmp);
+static int frozen(int block);
+static void sweep_frozen();
+static void init_dir_block(char *base, int i);
+static void set_inode_used(int ino, int used);
+static void load_dir(void *ptr, int len);
+static int map_dir_blocks(void *ptr, int len);
+static int dir_block_phys(int i);
+static inode_t *get_inode(int ino);
+static void write_superblock();
+static int check_superblock(char *image, superblock_t *sb);
+
+// volume geometry, from the format descriptor or the superblock
+int block_size;
+int num_blocks;
+int max_inodes;
+int ptrs_per_block;		// block pointers held by a map block
+int max_file_blocks;	// logical blocks a file can address (and whose bytes fit in an int)
+
 open_fd_table_t *ofdt;
+superblock_t *superblock;	// block 0, kept for the snapshot roots and the j-node
+
+// the cached dir: the header and inodes in files_blocks blocks, then the
+// entries. dir blocks get a disk block the first time they are used: the
+// j-node (superblock->root, copied as root.blks) maps the blocks of inodes,
+// dir.blks those of entries
 directory_t *dir;
-bit_array_t *FBM, *WM;
+dir_entry_t *dir_entries;	// dir block files_blocks onwards
+int files_blocks;
+int dir_blocks;
+int *dir_phys;		// disk block of each dir block: 0 until looked up, -1 if it has none yet
+
+// IBM: bit i set while inode i is free, ibm_blocks blocks right after the journal
+uint64_t *IBM;
+int ibm_words;
+int ibm_blocks;
+int ibm_start;
+int ibm_cursor;		// no free inode in the IBM words before this one
+char *ibm_dirty;	// one flag per block of the IBM
+int data_start;		// first block of the data area, right after the IBM
+
+// FBM and WM each take fbm_blocks blocks at the end of the disk
+uint64_t *FBM, *WM;
+int fbm_words;
+int fbm_blocks;
+int fbm_start;
+int wm_start;
+int fbm_free;		// number of 1 bits in the FBM, kept in step by alloc/free_block
+int fbm_cursor;		// next-fit: FBM word the next allocation starts from
+int cache_blocks = DEFAULT_CACHE_BLOCKS;
+
+// how the next mkssfs/mkssfs_format opens the image, see ssfs_set_backend
+int disk_backend = DISK_BACKEND_MMAP;
+
+// dir blocks are read in the first time they are used, see load_dir
+char *dir_loaded;	// one flag per block of the cached dir, set once it holds the disk's copy
+
+// metadata blocks changed since the last sync_metadata()
+char *dir_dirty;	// one flag per block of the cached dir
+int *dir_dirty_list;	// the dir blocks flagged, so a sync does not look at every block
+int dir_dirty_count;
+char *fbm_dirty;	// one flag per block of the FBM
+char *wm_dirty;		// one flag per block of the WM
+
+// snapshots: dir blocks changed since the last commit (2: maybe, after a mount)
+char *dir_changed;
+int frozen_released;	// frozen blocks may have become unused since the last sweep_frozen()
+
+// counters and latencies, see ssfs_get_stats; updated with relaxed atomics
+ssfs_stats_t stats;
+#define STAT_ADD(field, n)	__atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+
+// metadata goes through the journal; operations since the last commit
+int use_journal;
+int pending_ops;
+
+// (directory, filename) -> inode number, open addressing with linear probing.
+// NULL after a mount until the first lookup builds it
+int *name_index;
+int name_index_mask;
+int name_index_count;	// entries in it; it doubles once they fill half the slots
+
+// directory path -> the directory's inode, see resolve_parent
+typedef struct _path_cache_t {
+	char *path;		// NULL while the slot is empty
+	int ino;
+	int gen;		// path_cache_gen when it was filled; the slot is stale once that moves on
+} path_cache_t;
+path_cache_t path_cache[PATH_CACHE_SLOTS];
+int path_cache_gen;
+
+// an async read or write, complete once all its disk transfers are
+struct _ssfs_req_t {
+	int result;			// bytes read or written, or -1
+	int pending;		// disk transfers not finished, +1 while still submitting
+	int complete;
+	ssfs_callback_t done;
+	void *arg;
+	ssfs_req_t *next;	// on the ready list, waiting for its callback
+};
+
+// one disk transfer of a request
+typedef struct _req_io_t {
+	disk_io_t io;
+	ssfs_req_t *req;
+	char *data;			// whole blocks, as read or to write
+	char *dest;			// reads: where the wanted bytes go in the caller's buffer
+	int skip;			// reads: bytes of data before the wanted ones
+	int len;
+	unsigned int *gens;	// writes: cache generation of each block when it was copied
+} req_io_t;
+
+// completed requests whose callback has not run yet
+ssfs_req_t *ready_head, *ready_tail;
 
-void mkssfs(int fresh){
-	superblock_t *superblock;
-	inode_t *jnode;
-	inode_t *dir_node;
+/* 
+ * Locks, always taken in this order:
+ *	commit_lock -> dir_lock -> fd_table_lock -> an fd's lock -> an inode's lock -> meta_lock -> alloc_lock
+ * Every call takes commit_lock for reading; ssfs_commit and ssfs_restore take
+ * it for writing, so they see (and replace) a quiet file system. dir_lock
+ * guards the names (dir_entries, name_index, dir->full) and the IBM. An
+ * inode's lock guards its file's data, size and block map, so reads of one
+ * file run in parallel and writes to different files do too. meta_lock guards
+ * changes to the cached dir, its dirty flags and the journal, and reading dir
+ * blocks in; alloc_lock guards the FBM and changes to the WM. path_cache_lock is taken under
+ * dir_lock, with nothing locked under it. The block cache and disk_emu have
+ * locks of their own, taken last.
+ */
+pthread_rwlock_t commit_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_rwlock_t dir_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_mutex_t fd_table_lock = PTHREAD_MUTEX_INITIALIZER;	// picking a free fd, ofdt->full
+pthread_rwlock_t *inode_locks;	// max_inodes of them
+int inode_lock_count;
+pthread_mutex_t meta_lock;		// recursive: map lookups happen while allocating
+pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t path_cache_lock = PTHREAD_MUTEX_INITIALIZER;	// lookups share dir_lock, so they fill it under this
+pthread_mutex_t req_lock = PTHREAD_MUTEX_INITIALIZER;	// async requests and the ready list
+pthread_cond_t req_cond = PTHREAD_COND_INITIALIZER;		// a request completed
+pthread_once_t meta_lock_once = PTHREAD_ONCE_INIT;
+
+static void meta_lock_init() {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&meta_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
 
-	if (fresh == 1) {
-		if (init_fresh_disk("holodisk", BLOCK_SIZE, NUM_BLOCKS) != 0)
-			fprintf(stderr, "Could not create new disk.\n");
-		
-		// initialize the open file desc table and dir caches
-		ofdt = (open_fd_table_t*)calloc(1, sizeof(open_fd_table_t));
-		ofdt->full = 0;
+static void lock_meta() {
+	pthread_mutex_lock(&meta_lock);
+}
 
-		// root node, points to all blocks containing i-nodes (dir->files)
-		jnode = (inode_t*)calloc(1, sizeof(inode_t));
-		jnode->size = MAX_INODES * sizeof(inode_t); // 72 * 64 = 4608 ~ 5 blocks
-		int dir_files_blocks = bytes_to_blocks_rnd_up(jnode->size);
+static void unlock_meta() {
+	pthread_mutex_unlock(&meta_lock);
+}
 
-		// the first i-node points to all the blocks containing the directory itself (dir->entries)
-		dir_node = (inode_t*)calloc(1, sizeof(inode_t));
-		dir_node->size = MAX_INODES * sizeof(dir_entry_t); // 72 * 16 = 1152 ~ 2 blocks
-		int dir_entries_blocks = bytes_to_blocks_rnd_up(dir_node->size);
+// the cache is write-back, so flush it if the process exits while mounted
+static void flush_at_exit() {
+	journal_checkpoint();
+	cache_flush();
+}
 
-		dir = (directory_t*)calloc(1, (dir_entries_blocks + dir_files_blocks)*BLOCK_SIZE);
-		dir->size = (dir_entries_blocks + dir_files_blocks) * BLOCK_SIZE;
-		dir->full = 0;
+/* 
+ * sets the geometry globals for a volume.
+ * returns 0 on success, -1 if the geometry is not usable.
+ */
+static int set_geometry(int bsize, int nblocks, int ninodes) {
+	if (bsize < MIN_BLOCK_SIZE || bsize > MAX_BLOCK_SIZE || (bsize & (bsize - 1)) != 0) {
+		fprintf(stderr, "Error: Block size must be a power of two in [%d, %d], got %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, bsize);
+		return -1;
+	}
+	if (nblocks <= 0 || (long long)nblocks * bsize > INT_MAX) {
+		fprintf(stderr, "Error: Volume of %d blocks of %d bytes is too big (max = %d bytes)\n", nblocks, bsize, INT_MAX);
+		return -1;
+	}
+	if (ninodes < 3) {
+		fprintf(stderr, "Error: Need at least 3 inodes, got %d\n", ninodes); // root.blks, dir.blks and one file
+		return -1;
+	}
+	if ((long long)ninodes * (sizeof(inode_t) + sizeof(dir_entry_t)) > INT_MAX / 2) {
+		fprintf(stderr, "Error: Too many inodes, got %d\n", ninodes);
+		return -1;
+	}
 
-		// initialize ofdt and dir to empty entries
-		for (int i = 0; i < MAX_OPEN_FILES; i++) {
-			ofdt->entries[i].inode_no = -1;
-			ofdt->entries[i].read_ptr = -1;
-			ofdt->entries[i].write_ptr = -1;
+	block_size = bsize;
+	num_blocks = nblocks;
+	max_inodes = ninodes;
 
-			ofdt->entries[i].inode.size = -1;
-			ofdt->entries[i].inode.indirect = -1;
-			for (int j = 0; j < NUM_DIRECT_BLOCKS; j++)
-				ofdt->entries[i].inode.direct[j] = -1;
-		}
+	// file sizes are ints, so stop addressing blocks once their bytes would overflow
+	ptrs_per_block = block_size / (int)sizeof(int);
+	long long addressable = NUM_DIRECT_BLOCKS + ptrs_per_block + (long long)ptrs_per_block * ptrs_per_block;
+	max_file_blocks = addressable < INT_MAX / block_size ? (int)addressable : INT_MAX / block_size;
+
+	fbm_words = (num_blocks + 63) / 64;
+	fbm_blocks = bytes_to_blocks_rnd_up(fbm_words * sizeof(uint64_t));
+	fbm_start = num_blocks - 2 * fbm_blocks;
+	wm_start = num_blocks - fbm_blocks;
+
+	files_blocks = bytes_to_blocks_rnd_up(sizeof(directory_t) + max_inodes * sizeof(inode_t));
+	dir_blocks = files_blocks + bytes_to_blocks_rnd_up(max_inodes * sizeof(dir_entry_t));
+	ibm_words = (max_inodes + 63) / 64;
+	ibm_blocks = bytes_to_blocks_rnd_up(ibm_words * sizeof(uint64_t));
+
+	// the dir is mapped like a file, and so are the snapshots of it
+	if (dir_blocks > max_file_blocks) {
+		fprintf(stderr, "Error: Too many inodes for blocks of %d bytes, got %d\n", block_size, ninodes);
+		return -1;
+	}
+	return 0;
+}
+
+/* 
+ * reads the geometry fields at the start of the superblock, without
+ * knowing the block size yet.
+ * returns 0 on success, -1 on error.
+ */
+static int read_geometry(char *image, superblock_t *superblock) {
+	if (init_disk_backend(image, sizeof(superblock_t), 1, DISK_BACKEND_PIO) != 0)
+		return -1;
+	int ret = read_blocks(0, 1, superblock) == 1 ? 0 : -1;
+	close_disk();
+
+	return ret == 0 ? check_superblock(image, superblock) : -1;
+}
+
+// FNV-1a over every field of the superblock before the checksum
+static unsigned int superblock_checksum(superblock_t *sb) {
+	return fnv1a(FNV_SEED, sb, offsetof(superblock_t, checksum));
+}
+
+/* 
+ * checks that a superblock read from image is one this code can mount.
+ * returns 0 if so, -1 (with the reason on stderr) if not.
+ */
+static int check_superblock(char *image, superblock_t *sb) {
+	if (memcmp(sb->magic, SSFS_MAGIC, 4) != 0) {
+		fprintf(stderr, "Error: %s is not an ssfs volume (or predates the superblock magic); format it again\n", image);
+		return -1;
+	}
+	if (sb->version < 1 || sb->version > SSFS_VERSION) {
+		fprintf(stderr, "Error: %s has format version %d; this build reads up to %d\n", image, sb->version, SSFS_VERSION);
+		return -1;
+	}
+	if (sb->checksum != superblock_checksum(sb)) {
+		fprintf(stderr, "Error: The superblock of %s is corrupt (checksum mismatch)\n", image);
+		return -1;
+	}
+	return 0;
+}
+
+// writes the cached superblock back to block 0, with a fresh checksum
+static void write_superblock() {
+	superblock->checksum = superblock_checksum(superblock);
+	write_meta_block(0, superblock);
+}
+
+static void alloc_bitmaps() {
+	FBM = (uint64_t*)calloc(fbm_blocks, block_size);
+	WM  = (uint64_t*)calloc(fbm_blocks, block_size);
+	IBM = (uint64_t*)calloc(ibm_blocks, block_size);
+	fbm_dirty = (char*)calloc(fbm_blocks, sizeof(char));
+	wm_dirty = (char*)calloc(fbm_blocks, sizeof(char));
+	ibm_dirty = (char*)calloc(ibm_blocks, sizeof(char));
+	ibm_cursor = 0;
+}
+
+// a cached dir with nothing read in yet; see load_dir
+static void alloc_dir() {
+	free(dir);
+	free(dir_loaded);
+	free(dir_phys);
+	free(dir_dirty);
+	free(dir_dirty_list);
+	free(dir_changed);
+	dir = (directory_t*)calloc(dir_blocks, block_size);
+	dir_entries = (dir_entry_t*)((char*)dir + (size_t)files_blocks * block_size);
+	dir_loaded = (char*)calloc(dir_blocks, sizeof(char));
+	dir_phys = (int*)calloc(dir_blocks, sizeof(int));
+	dir_dirty = (char*)calloc(dir_blocks, sizeof(char));
+	dir_dirty_list = (int*)malloc(dir_blocks * sizeof(int));
+	dir_dirty_count = 0;
+	dir_changed = (char*)calloc(dir_blocks, sizeof(char));
+}
+
+// a new open fd table with every entry free
+static void init_fd_table() {
+	ofdt = (open_fd_table_t*)calloc(1, sizeof(open_fd_table_t));
+	ofdt->full = 0;
+
+	for (int i = 0; i < MAX_OPEN_FILES; i++) {
+		ofdt->entries[i].inode_no = -1;
+		ofdt->entries[i].read_ptr = -1;
+		ofdt->entries[i].write_ptr = -1;
+
+		ofdt->entries[i].inode.size = -1;
+		ofdt->entries[i].inode.indirect = -1;
+		ofdt->entries[i].inode.double_indirect = -1;
+		for (int j = 0; j < MAP_CACHE_SLOTS; j++)
+			ofdt->entries[i].maps[j].block = -1;
+		for (int j = 0; j < NUM_DIRECT_BLOCKS; j++)
+			ofdt->entries[i].inode.direct[j] = -1;
+		pthread_mutex_init(&ofdt->entries[i].lock, NULL);
+	}
+}
+
+// reuses the locks of the last mount when there are enough of them, so
+// remounting does not cost a lock per inode
+static void init_inode_locks() {
+	if (inode_lock_count >= max_inodes)
+		return;
+	for (int i = 0; i < inode_lock_count; i++)
+		pthread_rwlock_destroy(&inode_locks[i]);
+	free(inode_locks);
+
+	inode_locks = (pthread_rwlock_t*)malloc(max_inodes * sizeof(pthread_rwlock_t));
+	for (int i = 0; i < max_inodes; i++)
+		pthread_rwlock_init(&inode_locks[i], NULL);
+	inode_lock_count = max_inodes;
+}
+
+/* 
+ * checks that fileID is open, then locks it and its inode (for writing if
+ * write is set) for the rest of the call.
+ * returns the fd entry, or NULL with nothing locked.
+ */
+static fd_entry_t *lock_fd(int fileID, int write) {
+	if (__atomic_load_n(&ofdt->full, __ATOMIC_ACQUIRE) == 0) {
+		fprintf(stderr, "Error: No open file descriptors\n");
+		return NULL;
+	}
+	if (fileID < 0 || fileID >= MAX_OPEN_FILES) {
+		fprintf(stderr, "Error: File descriptor %d out of bounds [0, %d]\n", fileID, MAX_OPEN_FILES);
+		return NULL;
+	}
+
+	fd_entry_t *fd = &ofdt->entries[fileID];
+	pthread_rwlock_rdlock(&commit_lock);
+	pthread_mutex_lock(&fd->lock);
+	int ino = __atomic_load_n(&fd->inode_no, __ATOMIC_ACQUIRE);
+	if (ino != -1) {
+		if (write)
+			pthread_rwlock_wrlock(&inode_locks[ino]);
+		else
+			pthread_rwlock_rdlock(&inode_locks[ino]);
+
+		// the file may have been removed (closing the fd) while we waited
+		if (__atomic_load_n(&fd->inode_no, __ATOMIC_ACQUIRE) == ino)
+			return fd;
+		pthread_rwlock_unlock(&inode_locks[ino]);
+	}
+	pthread_mutex_unlock(&fd->lock);
+	pthread_rwlock_unlock(&commit_lock);
+	fprintf(stderr, "Error: No open file associated with file descriptor %d\n", fileID);
+	return NULL;
+}
+
+static void unlock_fd(fd_entry_t *fd) {
+	pthread_rwlock_unlock(&inode_locks[fd->inode_no]);
+	pthread_mutex_unlock(&fd->lock);
+	pthread_rwlock_unlock(&commit_lock);
+}
 
-		for (int i = 0; i < MAX_INODES; i++) {
-			dir->entries[i].inode_no = -1;
-			dir->entries[i].filename[0] = '\0';
+// the volume mkssfs(fresh) creates or mounts
+static ssfs_format_t default_format = { "holodisk", 1024, 1024, 1024 };
 
-			dir->files[i].size = -1;
-			dir->files[i].indirect = -1;
-			for (int j = 0; j < NUM_DIRECT_BLOCKS; j++)
-				dir->files[i].direct[j] = -1;
+void mkssfs(int fresh){
+	mkssfs_format(fresh, &default_format);
+}
+
+/* 
+ * formats (fresh = 1) or mounts (fresh = 0) the volume in format->image.
+ * a fresh volume gets the geometry given in format, and it is kept in the
+ * superblock; mounting reads it back from there and ignores the rest of format.
+ * unlike the other calls, no other thread may be using the file system meanwhile.
+ * returns 0 on success, -1 on error.
+ */
+int mkssfs_format(int fresh, ssfs_format_t *format){
+	static int exit_hook = 0;
+
+	pthread_once(&meta_lock_once, meta_lock_init);
+
+	// drop the previous mount (and its mapping) if mkssfs is called again
+	journal_checkpoint();
+	journal_destroy();
+	cache_destroy();
+	close_disk();
+
+	if (!exit_hook) {
+		atexit(flush_at_exit);
+		exit_hook = 1;
+	}
+
+	if (fresh == 1) {
+		if (set_geometry(format->block_size, format->num_blocks, format->num_inodes) != 0)
+			return -1;
+
+		// the superblock, the journal and the IBM, then the data area, then the FBM and WM;
+		// dir blocks come from the data area as files are created
+		if (1 + JOURNAL_BLOCKS + ibm_blocks + 2 + 2 * fbm_blocks >= num_blocks) {
+			fprintf(stderr, "Error: Volume of %d blocks is too small for %d inodes\n", num_blocks, max_inodes);
+			return -1;
 		}
 
-		// initialize FBM, WM to 1's (all empty, all writable)
-		FBM = (bit_array_t*)calloc(1, BLOCK_SIZE);
-		WM  = (bit_array_t*)calloc(1, BLOCK_SIZE);
-		for (int i = 0; i < NUM_BLOCKS; i++) {
-			setBit(FBM->four_bytes, i);
-			setBit(WM->four_bytes , i);
+		if (init_fresh_disk_backend(format->image, block_size, num_blocks, disk_backend) != 0) {
+			fprintf(stderr, "Could not create new disk.\n");
+			return -1;
+		}
+		cache_init(cache_blocks, block_size);
+		
+		// initialize the open file desc table
+		init_fd_table();
+		init_inode_locks();
+
+		// initialize FBM, WM to 1's (all empty, all writable), a word at a time
+		alloc_bitmaps();
+		memset(FBM, 0xff, fbm_words * sizeof(uint64_t));
+		memset(WM, 0xff, fbm_words * sizeof(uint64_t));
+		if (num_blocks % 64 != 0) {
+			FBM[fbm_words - 1] = WM[fbm_words - 1] = ((uint64_t)1 << (num_blocks % 64)) - 1;
 		}
-		clrBit(FBM->four_bytes, NUM_BLOCKS-2);
-		clrBit(FBM->four_bytes, NUM_BLOCKS-1);
+		for (int i = fbm_start; i < num_blocks; i++)
+			clrBit(FBM, i);
 
 		// initialize superblock and reserve the first block for it
 		// TODO: cached? cannot update # of inodes properly
-		superblock = (superblock_t*)calloc(1, BLOCK_SIZE);
-		superblock->block_size = BLOCK_SIZE;
-		superblock->file_system_size = NUM_BLOCKS * BLOCK_SIZE;
+		free(superblock);
+		superblock = (superblock_t*)calloc(1, block_size);
+		memcpy(superblock->magic, SSFS_MAGIC, 4);
+		superblock->version = SSFS_VERSION;
+		superblock->block_size = block_size;
+		superblock->file_system_size = num_blocks * block_size;
+		superblock->num_blocks = num_blocks;
+		superblock->max_inodes = max_inodes;
 		superblock->no_of_inodes = 0;
-		superblock->dir_block_size = dir->size / BLOCK_SIZE;
-		superblock->root = *jnode;
-		int sb_index = get_next_free_block(FBM->four_bytes); // should be block 0
-		clrBit(FBM->four_bytes, sb_index);
-
-		// find free blocks to copy dir to, and reserve them
-		int nfb = 0;	
-		for (int i = 0; i < dir_files_blocks; i++) {
-			nfb = get_next_free_block(FBM->four_bytes);
-			jnode->direct[i] = nfb;
-			clrBit(FBM->four_bytes, nfb);
-		}
+		superblock->dir_block_size = dir_blocks;
+		superblock->last_shadow = -1;
+		int sb_index = get_next_free_block(FBM); // should be block 0
+		clrBit(FBM, sb_index);
+
+		// root node (j-node), points to all blocks containing i-nodes (dir->files)
+		superblock->root.size = max_inodes * sizeof(inode_t);
+		superblock->root.indirect = superblock->root.double_indirect = -1;
+		for (int i = 0; i < NUM_DIRECT_BLOCKS; i++)
+			superblock->root.direct[i] = -1;
+
+		// reserve the journal region right after the superblock, and the IBM after it
+		superblock->journal_start = sb_index + 1;
+		superblock->journal_blocks = JOURNAL_BLOCKS;
+		superblock->ibm_start = ibm_start = superblock->journal_start + JOURNAL_BLOCKS;
+		for (int i = superblock->journal_start; i < ibm_start + ibm_blocks; i++)
+			clrBit(FBM, i);
+		data_start = ibm_start + ibm_blocks;
+		fbm_count_free();
+
+		// every inode free but root.blks and dir.blks
+		memset(IBM, 0xff, ibm_words * sizeof(uint64_t));
+		if (max_inodes % 64 != 0)
+			IBM[ibm_words - 1] = ((uint64_t)1 << (max_inodes % 64)) - 1;
+		clrBit(IBM, 0);
+		clrBit(IBM, 1);
+
+		// the metadata goes straight to disk until the journal is set up below
+		use_journal = 0;
+		pending_ops = 0;
+		alloc_dir();
+		frozen_released = 0;
 
-		for (int i = 0; i < dir_entries_blocks; i++) {
-			nfb = get_next_free_block(FBM->four_bytes);
-			dir_node->direct[i] = nfb;
-			clrBit(FBM->four_bytes, nfb);
+		// the first i-node points to all the blocks containing the directory itself (dir->entries)
+		load_dir(dir, sizeof(directory_t));
+		dir->files[0] = superblock->root;
+		dir->files[1] = superblock->root;
+		dir->files[1].size = max_inodes * sizeof(dir_entry_t);
+
+		// the blocks of root.blks and dir.blks, and of their entries, are the first in use
+		if (map_dir_blocks(dir->files, 2 * sizeof(inode_t)) != 0 ||
+			map_dir_blocks(dir_entries, 2 * sizeof(dir_entry_t)) != 0) {
+			fprintf(stderr, "Error: Volume of %d blocks is too small for %d inodes\n", num_blocks, max_inodes);
+			return -1;
 		}
 
-		// add root and dir nodes to dir->entries and dir->files
-		dir->files[0] = *jnode;
-		dir->entries[0].inode_no = get_next_free_dir();
-		strcpy(dir->entries[0].filename, "root.blks");
-		superblock->no_of_inodes = ++dir->full;
-
-		dir->files[1] = *dir_node;
-		dir->entries[1].inode_no = get_next_free_dir();
-		strcpy(dir->entries[1].filename, "dir.blks");
-		superblock->no_of_inodes = ++dir->full;
-
-		// copy blocks to buffer, and write to disk
-		char *buf = (char*)calloc(1, BLOCK_SIZE_NULL_T);
-		buf[BLOCK_SIZE] = '\0';
-
-		memcpy(buf, superblock, BLOCK_SIZE);
-		write_blocks(sb_index, 1, buf);
-		free(buf);
-
-		// separate functions since these will be accessed often
+		// add root and dir nodes to dir->entries
+		dir_entries[0].inode_no = 0;
+		strcpy(dir_entries[0].filename, "root.blks");
+		dir_entries[0].parent = ROOT_DIR;
+		dir_entries[1].inode_no = 1;
+		strcpy(dir_entries[1].filename, "dir.blks");
+		dir_entries[1].parent = ROOT_DIR;
+		superblock->no_of_inodes = dir->full = 2;
+		mark_inode_dirty(0);
+		mark_inode_dirty(1);
+
+		// separate functions since these will be accessed often.
+		// only the dir blocks in use are written, the rest of the disk stays a hole until used
+		write_superblock();
 		write_dir_to_disk();
 		write_fbm_to_disk();
 		write_wm_to_disk();
+		write_ibm_to_disk();
 
-		free(jnode);
-		free(dir_node);
-		free(superblock);
+		journal_init(superblock->journal_start, JOURNAL_BLOCKS, block_size);
+		journal_format();
+		use_journal = 1;
+		cache_flush();
+
+		// built by the first lookup
+		free(name_index);
+		name_index = NULL;
+		path_cache_clear();
 
 		// TODO: FREE GLOBALS
 
 	} else if (fresh == 0) {
-		if(init_disk("holodisk", BLOCK_SIZE, NUM_BLOCKS) != 0)
-			fprintf(stderr, "Could not create new disk.\n");
-
-		// initialize the open file desc table
-		ofdt = (open_fd_table_t*)calloc(1, sizeof(open_fd_table_t));
-		ofdt->full = 0;
-		
-		for (int i = 0; i < MAX_OPEN_FILES; i++) {
-			ofdt->entries[i].inode_no = -1;
-			ofdt->entries[i].read_ptr = -1;
-			ofdt->entries[i].write_ptr = -1;
+		superblock_t geometry;
+		if (read_geometry(format->image, &geometry) != 0 ||
+			set_geometry(geometry.block_size, geometry.num_blocks, geometry.max_inodes) != 0)
+			return -1;
 
-			ofdt->entries[i].inode.size = -1;
-			ofdt->entries[i].inode.indirect = -1;
-			for (int j = 0; j < NUM_DIRECT_BLOCKS; j++)
-				ofdt->entries[i].inode.direct[j] = -1;
+		if(init_disk_backend(format->image, block_size, num_blocks, disk_backend) != 0) {
+			fprintf(stderr, "Could not create new disk.\n");
+			return -1;
 		}
+		cache_init(cache_blocks, block_size);
 
-		// read parts of the file system
-		char *buf = (char*)calloc(1, BLOCK_SIZE_NULL_T);
-		buf[BLOCK_SIZE] = '\0';
+		// initialize the open file desc table
+		init_fd_table();
+		init_inode_locks();
 
 		// superblock
-		superblock = (superblock_t*)calloc(1, BLOCK_SIZE);
-		read_blocks(0, 1, superblock);
-
-		// FBM and WM
-		FBM = (bit_array_t*)calloc(1, BLOCK_SIZE);
-		WM  = (bit_array_t*)calloc(1, BLOCK_SIZE);
-		read_blocks(NUM_BLOCKS-2, 1, FBM);
-		read_blocks(NUM_BLOCKS-1, 1, WM);
-
-		// dir
-		dir = (directory_t*)calloc(1, superblock->dir_block_size);
-		read_blocks(1, 1 + superblock->dir_block_size, dir);
+		free(superblock);
+		superblock = (superblock_t*)calloc(1, block_size);
+		cache_read(0, 1, superblock);
+
+		// finish any metadata committed to the journal before the last shutdown
+		use_journal = superblock->journal_blocks > 0;
+		pending_ops = 0;
+		if (use_journal) {
+			journal_init(superblock->journal_start, superblock->journal_blocks, block_size);
+			if (journal_recover() < 0)
+				fprintf(stderr, "Error: Could not replay the journal\n");
+			cache_read(0, 1, superblock);	// commits may have been replayed into it
+			if (check_superblock(format->image, superblock) != 0)
+				return -1;
+		}
+		ibm_start = superblock->ibm_start;
+		data_start = ibm_start + ibm_blocks;
+
+		// FBM, WM and IBM
+		alloc_bitmaps();
+		cache_read(fbm_start, fbm_blocks, FBM);
+		cache_read(wm_start, fbm_blocks, WM);
+		cache_read(ibm_start, ibm_blocks, IBM);
+		fbm_count_free();
+
+		// dir: only its header now (found through the j-node), the rest as it is used
+		alloc_dir();
+		load_dir(dir, sizeof(directory_t));
+
+		// what changed since the last commit is not on disk; commit compares instead
+		memset(dir_changed, 2, dir_blocks);
+		frozen_released = 1;
+
+		free(name_index);
+		name_index = NULL;
+		path_cache_clear();
 	}
 
+	return 0;
 }
 
 /* 
- * opens a file, or creates it if it does not exist.
+ * opens a file, or creates it if it does not exist. the directories on
+ * its path ("dir/sub/name", see resolve_parent) must exist.
  * returns the file's index in the open fd table, or -1 on error.
  */
 int ssfs_fopen(char *name){
+	long start = now_ns();
+	int fd_index = open_file(name);
+	time_call(&stats.fopen, start);
+	return fd_index;
+}
+
+static int open_file(char *path) {
+	char name[SSFS_MAX_NAME + 1];
+	int parent;
+
 	// check if file exists; if so, store its index for later
-	int file_exists = -1;
-	for (int i = 0; i < MAX_INODES; i++)
-		if (strcmp(dir->entries[i].filename, name) == 0) {
-			file_exists = i;
-			break;
+	pthread_rwlock_rdlock(&commit_lock);
+	pthread_rwlock_rdlock(&dir_lock);
+	if (resolve_parent(path, &parent, name) != 0) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		return -1;
+	}
+	int file_exists = name_index_find(parent, name);
+
+	// creating it needs the dir for writing; look again, another thread may have created it
+	// (or removed its directory) meanwhile
+	if (file_exists == -1) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_wrlock(&dir_lock);
+		if (resolve_parent(path, &parent, name) != 0) {
+			pthread_rwlock_unlock(&dir_lock);
+			pthread_rwlock_unlock(&commit_lock);
+			return -1;
 		}
+		file_exists = name_index_find(parent, name);
+	}
 
-	if (dir->full == MAX_INODES && file_exists == -1) {
-		fprintf(stderr, "Error: Too many files in the file system (max = %d); cannot create a new file.\n", MAX_INODES);
+	if (file_exists != -1 && dir_entries[file_exists].is_dir) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: '%s' is a directory\n", path);
 		return -1;
 	}
-	if (ofdt->full == MAX_OPEN_FILES) {
+	pthread_mutex_lock(&fd_table_lock);
+	if (__atomic_load_n(&ofdt->full, __ATOMIC_ACQUIRE) == MAX_OPEN_FILES) {
+		pthread_mutex_unlock(&fd_table_lock);
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
 		fprintf(stderr, "Error: Too many open files (max = %d)\n", MAX_OPEN_FILES);
 		return -1;
 	}
 
 	// file does not exist; create it
 	if (file_exists == -1) {
-		file_exists = get_next_free_dir();
-		dir->files[file_exists].size = 0;
-		// no blocks associated with file yet -- don't adjust direct[i] pointers
-
-		dir->entries[file_exists].inode_no = file_exists;
-		strcpy(dir->entries[file_exists].filename, name);
-		dir->full++;
-
-		write_dir_to_disk();
+		file_exists = create_entry(parent, name, 0);
+		if (file_exists == -1) {
+			pthread_mutex_unlock(&fd_table_lock);
+			pthread_rwlock_unlock(&dir_lock);
+			pthread_rwlock_unlock(&commit_lock);
+			return -1;
+		}
 	}
 
-	// add file entry to open fd table
+	// add file entry to open fd table; the inode lock waits out writes in progress
 	int fd_index = get_next_free_fd();
-
-	ofdt->entries[fd_index].inode= dir->files[file_exists]; // copy of inode 
-	ofdt->entries[fd_index].inode_no = file_exists;
-	ofdt->entries[fd_index].read_ptr = 0;
-	ofdt->entries[fd_index].write_ptr = dir->files[file_exists].size; // size of 1024: [0, 1023], new data written to 1024 onwards
-	ofdt->full++;
-
+	fd_entry_t *fd = &ofdt->entries[fd_index];
+	pthread_mutex_lock(&fd->lock);
+	pthread_rwlock_wrlock(&inode_locks[file_exists]);
+
+	fd->inode= *get_inode(file_exists); // copy of inode 
+	fd->read_ptr = 0;
+	fd->ra_next = 0;
+	fd->ra_window = 0;
+	fd->ra_end = 0;
+	fd->write_ptr = dir->files[file_exists].size; // size of 1024: [0, 1023], new data written to 1024 onwards
+	__atomic_store_n(&fd->inode_no, file_exists, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&ofdt->full, 1, __ATOMIC_RELEASE);
+
+	pthread_rwlock_unlock(&inode_locks[file_exists]);
+	pthread_mutex_unlock(&fd->lock);
+	pthread_mutex_unlock(&fd_table_lock);
+	pthread_rwlock_unlock(&dir_lock);
+	pthread_rwlock_unlock(&commit_lock);
     return fd_index;
 }
 
@@ -275,25 +776,22 @@ int ssfs_fopen(char *name){
  * returns 0 on success, -1 on error.
  */
 int ssfs_fclose(int fileID) {
-	if (ofdt->full == 0) {
-		fprintf(stderr, "Error: No open file descriptors\n");
-		return -1;
-	}
-	if (fileID < 0 || fileID >= MAX_OPEN_FILES) {
-		fprintf(stderr, "Error: File descriptor %d out of bounds [0, %d]\n", fileID, MAX_OPEN_FILES);
-		return -1;
-	}
-	if (ofdt->entries[fileID].inode_no == -1) {
-		fprintf(stderr, "Error: No open file associated with file descriptor %d\n", fileID);
+	// for writing: fds writing to the same file update this one's map cache
+	fd_entry_t *fd = lock_fd(fileID, 1);
+	if (fd == NULL)
 		return -1;
-	}
-
-	ofdt->entries[fileID].inode_no = -1;
-	ofdt->entries[fileID].inode.size = -1;
-	ofdt->entries[fileID].read_ptr = -1;
-	ofdt->entries[fileID].write_ptr = -1;
-
-	ofdt->full--;
+	int ino = fd->inode_no;
+
+	drop_maps(fileID);
+	__atomic_store_n(&fd->inode_no, -1, __ATOMIC_RELEASE);
+	fd->inode.size = -1;
+	fd->read_ptr = -1;
+	fd->write_ptr = -1;
+
+	__atomic_sub_fetch(&ofdt->full, 1, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&inode_locks[ino]);
+	pthread_mutex_unlock(&fd->lock);
+	pthread_rwlock_unlock(&commit_lock);
 	return 0;
 }
 
@@ -302,27 +800,21 @@ int ssfs_fclose(int fileID) {
  * returns 0 on success, -1 on error.
  */
 int ssfs_frseek(int fileID, int loc) {
-	if (ofdt->full == 0) {
-		fprintf(stderr, "Error: No open file descriptors\n");
+	fd_entry_t *fd = lock_fd(fileID, 0);
+	if (fd == NULL)
 		return -1;
-	}
-	if (fileID < 0 || fileID > MAX_OPEN_FILES) {
-		fprintf(stderr, "Error: File descriptor %d out of bounds [0, %d]\n", fileID, MAX_OPEN_FILES);
-		return -1;
-	}
-	if (ofdt->entries[fileID].inode_no   == -1 || 
-		ofdt->entries[fileID].inode.size == -1) {
-		fprintf(stderr, "Error: No open file associated with file descriptor %d\n", fileID);
-		return -1;
-	}
-	if (loc < 0 || 
-		(loc >= ofdt->entries[fileID].inode.size && loc != 0) || // cannot read at or past the size, due to indexes being [0, size-1] unless size is 0
-		loc >= BLOCK_SIZE * NUM_DIRECT_BLOCKS) {
-		fprintf(stderr, "Error: Read  pointer cannot be moved to %d; file size is %d\n", loc, ofdt->entries[fileID].inode.size);
+
+	// the size in the dir is current even if another fd grew the file
+	int size = dir->files[fd->inode_no].size;
+	if (loc < 0 || loc > size || // the end of file is a valid position
+		loc >= block_size * max_file_blocks) {
+		unlock_fd(fd);
+		fprintf(stderr, "Error: Read  pointer cannot be moved to %d; file size is %d\n", loc, size);
 		return -1;
 	}
 
-	ofdt->entries[fileID].read_ptr = loc;
+	fd->read_ptr = loc;
+	unlock_fd(fd);
     return 0;
 }
 
@@ -331,27 +823,21 @@ int ssfs_frseek(int fileID, int loc) {
  * returns 0 on success, -1 on error.
  */
 int ssfs_fwseek(int fileID, int loc) {
-	if (ofdt->full == 0) {
-		fprintf(stderr, "Error: No open file descriptors\n");
+	fd_entry_t *fd = lock_fd(fileID, 0);
+	if (fd == NULL)
 		return -1;
-	}
-	if (fileID < 0 || fileID > MAX_OPEN_FILES) {
-		fprintf(stderr, "Error: File descriptor %d out of bounds [0, %d]\n", fileID, MAX_OPEN_FILES);
-		return -1;
-	}
-	if (ofdt->entries[fileID].inode_no   == -1 || 
-		ofdt->entries[fileID].inode.size == -1) {
-		fprintf(stderr, "Error: No open file associated with file descriptor %d\n", fileID);
-		return -1;
-	}
-	if (loc < 0 || 
-		(loc >= ofdt->entries[fileID].inode.size && loc != 0) || // cannot read at or past the size, due to indexes being [0, size-1] unless size is 0
-		loc >= BLOCK_SIZE * NUM_DIRECT_BLOCKS) {
-		fprintf(stderr, "Error: Write pointer cannot be moved to %d; file size is %d\n", loc, ofdt->entries[fileID].inode.size);
+
+	// the size in the dir is current even if another fd grew the file
+	int size = dir->files[fd->inode_no].size;
+	if (loc < 0 || loc > size || // the end of file is a valid position
+		loc >= block_size * max_file_blocks) {
+		unlock_fd(fd);
+		fprintf(stderr, "Error: Write pointer cannot be moved to %d; file size is %d\n", loc, size);
 		return -1;
 	}
 
-	ofdt->entries[fileID].write_ptr = loc;
+	fd->write_ptr = loc;
+	unlock_fd(fd);
     return 0;
 }
 
@@ -361,101 +847,155 @@ int ssfs_fwseek(int fileID, int loc) {
  * returns the number of bytes written, or -1 on error.
  */
 int ssfs_fwrite(int fileID, char *buf, int length) {
-	if (ofdt->full == 0) {
-		fprintf(stderr, "Error: No open file descriptors\n");
-		return -1;
-	}
-	if (fileID < 0 || fileID >= MAX_OPEN_FILES) {
-		fprintf(stderr, "Error: File descriptor %d out of bounds [0, %d]\n", fileID, MAX_OPEN_FILES);
-		return -1;
-	}
-	if (ofdt->entries[fileID].inode_no == -1) {
-		fprintf(stderr, "Error: No open file associated with file descriptor %d\n", fileID);
-		return -1;
+	long start = now_ns();
+	int written = -1;
+	fd_entry_t *fd = lock_fd(fileID, 1);
+	if (fd != NULL) {
+		written = fwrite_locked(fileID, buf, length, &fd->write_ptr);
+		unlock_fd(fd);
 	}
+	time_call(&stats.fwrite, start);
+	return written;
+}
+
+// ssfs_fwrite with the fd and its inode locked for writing; writes at *pos and moves it past the data
+static int fwrite_locked(int fileID, char *buf, int length, int *pos) {
 	if (length <= 0) {
 		fprintf(stderr, "Error: Cannot write less than or 0 bytes\n");
 		return -1;
 	}
 
 	int ino = ofdt->entries[fileID].inode_no;
+	inode_t *inode = &dir->files[ino];
+	int start = *pos;
+	int end = start + length;
 
-	// find the block in which we need to write
-	int start_write_in_this_block = bytes_to_blocks_rnd_down(ofdt->entries[fileID].write_ptr); // round down (write inside a full block)
-
-	// find how many blocks the write operation needs to modify
-	// even if the size of the write is only 2 blocks, may need to modify 3 depending on how many blocks are overlapped
-	int req_blocks = bytes_to_blocks_rnd_up(length + ofdt->entries[fileID].write_ptr); // round up (need n free blocks)
+	// first and last block touched by the write
+	int first = start / block_size;
+	int last = (end - 1) / block_size;
 
-	// TODO: use indirect inode pointer to solve this
-	if (req_blocks > NUM_DIRECT_BLOCKS) {
+	if (start > block_size * max_file_blocks - length) {
 		fprintf(stderr, "Error: File too big; cannot fit in free blocks\n");
 		return -1;
 	}
 
-	int free_blocks_in_mem = 0;
-	for (int i = 0; i < NUM_BLOCKS; i++)
-		if (getBit(FBM->four_bytes, i) == 1)
-			free_blocks_in_mem++;
+	// data blocks not allocated yet or frozen by a snapshot, plus the map blocks needed to point to them
+	int missing = map_blocks_needed(inode, first, last);
+	for (int i = first; i <= last; i++) {
+		int phys = bmap(fileID, i);
+		if (phys == -1 || frozen(phys))
+			missing++;
+	}
 
-	if (req_blocks > free_blocks_in_mem) {
+	pthread_mutex_lock(&alloc_lock);
+	int free_blocks = fbm_free;
+	pthread_mutex_unlock(&alloc_lock);
+	if (missing > free_blocks && frozen_released) {
+		sweep_frozen();
+		pthread_mutex_lock(&alloc_lock);
+		free_blocks = fbm_free;
+		pthread_mutex_unlock(&alloc_lock);
+	}
+	if (missing > free_blocks) {
 		fprintf(stderr, "Error: Filesystem too full to write file\n");
 		return -1;
 	}
 
-	int it = 0; // i != iteration, so need a separate counter
-	int buf_ptr = 0;
-	int size_of_write = 0;
-	int end_ptr_loc = ofdt->entries[fileID].write_ptr + length; // TODO: move write_ptr to this after write?
-	
-	// position to write to, relative to start of the first block (will never be > 1024)
-	int wpos_rel = ofdt->entries[fileID].write_ptr - start_write_in_this_block * BLOCK_SIZE;
-
-	char *tmp = (char*)calloc(1, BLOCK_SIZE_NULL_T);
-	tmp[BLOCK_SIZE] = '\0';
-
-	for (int i = start_write_in_this_block; i < start_write_in_this_block + req_blocks; i++) {
-		int write_loc = dir->files[ino].direct[i];
-
-		// trying to write to empty block. assign a new block to this file for writing
-		if (write_loc == -1) {
-			int nfb = get_next_free_block(FBM->four_bytes);
-			write_loc = nfb;
-			dir->files[ino].direct[i] = nfb;
-			clrBit(FBM->four_bytes, nfb);
+	// blocks past the old end of file hold no data yet, so they need no read-modify-write;
+	// the partial first and last blocks are read from where they were before the write
+	int old_blocks = bytes_to_blocks_rnd_up(inode->size);
+	int old_first = bmap(fileID, first);
+	int old_last = bmap(fileID, last);
+
+	// copy-on-write: frozen blocks stay with their snapshots, the write gets new ones
+	lock_meta();
+	for (int i = first; i <= last; i++) {
+		int phys = bmap(fileID, i);
+		if (phys != -1 && frozen(phys) && bmap_set(fileID, i, -1) != 0) {
+			unlock_meta();
+			fprintf(stderr, "Error: Filesystem too full to write file\n");
+			return -1;
 		}
+	}
+	unlock_meta();
 
-		if (end_ptr_loc - BLOCK_SIZE * it < BLOCK_SIZE)
-			size_of_write = end_ptr_loc - BLOCK_SIZE * it - wpos_rel; // wpos_rel will be =0 if not on first iteration
-		else
-			size_of_write = BLOCK_SIZE - wpos_rel;
-
-		// wpos_rel is not at the start of the block => we are at the first iteration of this loop
-		// need to preserve old part of a block and start writing from there
-		if ((wpos_rel % BLOCK_SIZE) != 0)
-			read_blocks(write_loc, 1, tmp);
+	if (allocate_file_blocks(fileID, first, last) != 0) {
+		fprintf(stderr, "Error: Filesystem too full to write file\n");
+		return -1;
+	}
 
-		memcpy(tmp + wpos_rel, buf + buf_ptr, size_of_write);
-		write_blocks(write_loc, 1, tmp);
+	// bounce buffer for the partial first and last blocks; whole blocks go straight from buf
+	char *tmp = (char*)malloc(block_size);
+	int failed = 0;
+
+	for (int i = first; i <= last && !failed; ) {
+		int n = contiguous_run(fileID, i, last);
+		int phys = bmap(fileID, i);
+		int run_start = i * block_size;
+		int from = start > run_start ? start : run_start;
+		int to = end < (i + n) * block_size ? end : (i + n) * block_size;
+
+		int j = 0;	// blocks of the run written so far
+		if (from % block_size != 0 || to - run_start < block_size) {
+			int len = (to < run_start + block_size ? to : run_start + block_size) - from;
+			if (write_partial_block(phys, i < old_blocks ? (i == first ? old_first : old_last) : -1,
+					from - run_start, buf + (from - start), len, tmp) != 0)
+				failed = 1;
+			j = 1;
+		}
 
+		int full = to / block_size - (i + j);
+		if (full > 0 && !failed) {
+			if (cache_write(phys + j, full, buf + ((i + j) * block_size - start)) != full)
+				failed = 1;
+			j += full;
+		}
 
-		// reset wpos_rel to write from beginning of a block from now on
-		if ((wpos_rel % BLOCK_SIZE) != 0)
-			wpos_rel = 0;
-		
-		buf_ptr += size_of_write;
-		it++;
+		if (j < n && !failed) {
+			int tail = (i + n - 1) * block_size;
+			if (write_partial_block(phys + n - 1, i + n - 1 < old_blocks ? old_last : -1, 0, buf + (tail - start), to - tail, tmp) != 0)
+				failed = 1;
+		}
+		i += n;
 	}
+	free(tmp);
 
-	dir->files[ino].size += buf_ptr;
-	ofdt->entries[fileID].inode = dir->files[ino];
+	// the blocks stay allocated either way; a failed write leaves the size and pointer alone
+	lock_meta();
+	if (!failed && end > inode->size)
+		inode->size = end;
+	if (!failed)
+		*pos = end;
+	ofdt->entries[fileID].inode = *inode;
 
-	write_dir_to_disk();
-	write_fbm_to_disk();
+	mark_dir_dirty(inode, sizeof(inode_t));
+	sync_metadata();
+	unlock_meta();
 
-	free(tmp);
+	if (failed) {
+		fprintf(stderr, "Error: Could not write to the disk\n");
+		return -1;
+	}
+	STAT_ADD(bytes_written, length);
+    return length;
+}
 
-    return buf_ptr;
+/* 
+ * writes len bytes at offset into one block, keeping the rest of it:
+ * the contents of block old (itself, or the frozen block it replaces),
+ * or zeros if old is -1.
+ * returns 0 on success, -1 if the disk failed.
+ */
+static int write_partial_block(int block, int old, int offset, char *src, int len, char *tmp) {
+	if (old != -1) {
+		if (cache_read(old, 1, tmp) != 1)
+			return -1;
+		STAT_ADD(rmw_blocks, 1);
+	}
+	else
+		memset(tmp, 0, block_size);
+	memcpy(tmp + offset, src, len);
+	return cache_write(block, 1, tmp) == 1 ? 0 : -1;
 }
 
 /* 
@@ -464,201 +1004,2216 @@ int ssfs_fwrite(int fileID, char *buf, int length) {
  * returns the number of bytes read, or -1 on error.
  */
 int ssfs_fread(int fileID, char *buf, int length) {
-	if (ofdt->full == 0) {
-		fprintf(stderr, "Error: No open file descriptors\n");
-		return -1;
-	}
-	if (fileID < 0 || fileID >= MAX_OPEN_FILES) {
-		fprintf(stderr, "Error: File descriptor %d out of bounds [0, %d]\n", fileID, MAX_OPEN_FILES);
-		return -1;
-	}
-	if (ofdt->entries[fileID].inode_no == -1) {
-		fprintf(stderr, "Error: No open file associated with file descriptor %d\n", fileID);
-		return -1;
+	long start = now_ns();
+	int nread = -1;
+	fd_entry_t *fd = lock_fd(fileID, 0);
+	if (fd != NULL) {
+		nread = fread_locked(fileID, buf, length, &fd->read_ptr);
+		unlock_fd(fd);
 	}
+	time_call(&stats.fread, start);
+	return nread;
+}
+
+// ssfs_fread with the fd locked and its inode locked for reading; reads at *pos and moves it past the data
+static int fread_locked(int fileID, char *buf, int length, int *pos) {
 	if (length <= 0) {
 		fprintf(stderr, "Error: Cannot read less than or 0 bytes\n");
 		return -1;
 	}
 
 	int ino = ofdt->entries[fileID].inode_no;
+	inode_t *inode = &dir->files[ino];
+	int start = *pos;
 
-	// find the block in which we need to read
-	int start_read_in_this_block = bytes_to_blocks_rnd_down(ofdt->entries[fileID].read_ptr); // round down (read inside a full block)
-
-	// find how many blocks need to be read
-	int req_blocks = bytes_to_blocks_rnd_up(length + ofdt->entries[fileID].read_ptr);
-
-	if (req_blocks > NUM_DIRECT_BLOCKS) {
-		fprintf(stderr, "Error: Asking to read too many blocks\n");
-		return -1;
-	}
+	// reading past the end of file returns only what is there
+	int end = start + length;
+	if (end > inode->size)
+		end = inode->size;
+	if (end <= start)
+		return 0;
 
-	int it = 0; // i != iteration, so need a separate counter
-	int buf_ptr = 0;
-	int size_of_read = 0;
-	int end_ptr_loc = ofdt->entries[fileID].read_ptr + length; // TODO: move read_ptr to this after write?
-	
-	// position to read from, relative to start of block (will never be > 1024)
-	int rpos_rel = ofdt->entries[fileID].read_ptr - start_read_in_this_block * BLOCK_SIZE;
+	int first = start / block_size;
+	int last = (end - 1) / block_size;
 
-	char *tmp = (char*)calloc(1, BLOCK_SIZE_NULL_T);
-	tmp[BLOCK_SIZE] = '\0';
+	// on sequential reads the missing blocks come in with the read-ahead, in as few reads as possible
+	read_ahead(fileID, first, last);
 
-	for (int i = start_read_in_this_block; i < start_read_in_this_block + req_blocks; i++) {
-		int read_loc = dir->files[ino].direct[i];
+	int span = last - first + 1;
+	char *tmp = (char*)malloc((size_t)(span < MAX_IO_BLOCKS ? span : MAX_IO_BLOCKS) * block_size);
 
+	for (int i = first; i <= last; ) {
 		// trying to read from an empty block.
-		if (read_loc == -1) {
+		int phys = bmap(fileID, i);
+		if (phys == -1) {
 			fprintf(stderr, "Error: read pointer points to an empty block\n");
 			free(tmp);
 			return -1;
 		}
 
-		read_blocks(read_loc, 1, tmp);
-
-		if (end_ptr_loc - BLOCK_SIZE * it < BLOCK_SIZE)
-			size_of_read = end_ptr_loc - BLOCK_SIZE * it - rpos_rel; // rpos_rel will be =0 if not on first iteration
-		else
-			size_of_read = BLOCK_SIZE - rpos_rel;
-
-		memcpy(buf + buf_ptr, tmp + rpos_rel, size_of_read);
-		
-		// reset rpos_rel to read from beginning of a block from now on
-		if ((rpos_rel % BLOCK_SIZE) != 0)
-			rpos_rel = 0;
+		// physically contiguous blocks come in with a single read
+		int n = contiguous_run(fileID, i, last);
+		int run_start = i * block_size;
+		int from = start > run_start ? start : run_start;
+		int to = end < (i + n) * block_size ? end : (i + n) * block_size;
 
-		buf_ptr += size_of_read;
-		it++;
+		if (cache_read(phys, n, tmp) != n) {
+			fprintf(stderr, "Error: Could not read from the disk\n");
+			free(tmp);
+			return -1;
+		}
+		memcpy(buf + (from - start), tmp + (from - run_start), to - from);
+		i += n;
 	}
-
 	free(tmp);
 
-    return buf_ptr;
+	*pos = end;
+	ofdt->entries[fileID].ra_next = end / block_size;
+	STAT_ADD(bytes_read, end - start);
+    return end - start;
 }
 
 /* 
- * removes the file and all associated data:
- * 	- removes entry from the directory
- *	- removes i-node pointing to the file's data blocks
- *	- sets the occupied data blocks to free in the FBM
- * returns 0 on success, -1 on error.
+ * Scatter-gather and positional I/O. The vector calls move the whole
+ * transfer through one fwrite_locked/fread_locked, so the data goes out in
+ * contiguous runs and the metadata is synced once, however many buffers
+ * there are. More than one buffer goes through a bounce buffer.
  */
-int ssfs_remove(char *file) {
-	int file_exists = -1;
-	for (int i = 0; i < MAX_INODES; i++)
-		if (strcmp(dir->entries[i].filename, file) == 0)
-			file_exists = i;
 
-	if (dir->full == 0) {
-		fprintf(stderr, "Error: There are no files in the file system\n");
-		return -1;
-	}
-	if (file_exists == -1) {
-		fprintf(stderr, "Error: Could not find the file '%s' in the file system\n", file);
+// total bytes of iov, or -1 if it is not a valid vector
+static int iov_length(const struct iovec *iov, int iovcnt) {
+	long long total = 0;
+	if (iov == NULL || iovcnt <= 0)
 		return -1;
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > 0 && iov[i].iov_base == NULL)
+			return -1;
+		total += iov[i].iov_len;
+		if (total > INT_MAX)
+			return -1;
 	}
+	return (int)total;
+}
 
-	// free blocks associated with inode
-	for (int i = 0; i < NUM_DIRECT_BLOCKS; i++)
-		setBit(FBM->four_bytes, dir->files[file_exists].direct[i]);
-
-	// mark inode and its entry as free
-	dir->files[file_exists].size = -1;
-	dir->entries[file_exists].inode_no = -1;
-	dir->full--;
-
-	write_dir_to_disk();
-	write_fbm_to_disk();
-
-    return 0;
+// the one buffer of iov holding data, or NULL if there are several
+static char *iov_single(const struct iovec *iov, int iovcnt) {
+	char *single = NULL;
+	for (int i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len == 0)
+			continue;
+		if (single != NULL)
+			return NULL;
+		single = (char*)iov[i].iov_base;
+	}
+	return single;
 }
 
 /* 
- * Functions that interact with the FBM and WM, which are bit arrays 
- * that use an array of ints for representation.
- * 	- setBit: set bit at bit index i to 1
- * 	- clrBit: set bit at bit index i to 0
- * 	- getBit: get bit at bit index i
- * adapted from http://www.mathcs.emory.edu/~cheung/Courses/255/Syllabus/1-C-intro/bit-array.html
+ * writes the buffers of iov one after the other at the write pointer, as
+ * one write.
+ * returns the number of bytes written (0 if the buffers are all empty,
+ * without looking at the fd), or -1 on error.
  */
-void setBit(int *bit_array, int i) {
-	int index = i / sizeof(int);
-	int bit_pos = i % sizeof(int);
-	int set = 1;		  // 00000000 00000000 00000000 00000001
-	set = set << bit_pos; // bitwise shift left by x positions
-
-	//printf("setting int at %d to %d\n", index, array[index] | set);
-	bit_array[index] = bit_array[index] | set; // binary or
-}
-
-void clrBit(int *bit_array, int i) {
-	int index = i / sizeof(int);
-	int bit_pos = i % sizeof(int);
-	int set = 1;		  		// 00000000 00000000 00000000 00000001
+int ssfs_fwritev(int fileID, const struct iovec *iov, int iovcnt) {
+	int length = iov_length(iov, iovcnt);
+	if (length < 0) {
+		fprintf(stderr, "Error: Invalid write vector\n");
+		return -1;
+	}
+	if (length == 0)
+		return 0;
+
+	long start = now_ns();
+	int written = -1;
+	fd_entry_t *fd = lock_fd(fileID, 1);
+	if (fd != NULL) {
+		char *buf = iov_single(iov, iovcnt);
+		if (buf != NULL) {
+			written = fwrite_locked(fileID, buf, length, &fd->write_ptr);
+		} else {
+			buf = (char*)malloc(length);
+			for (int i = 0, off = 0; i < iovcnt; off += iov[i].iov_len, i++)
+				memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+			written = fwrite_locked(fileID, buf, length, &fd->write_ptr);
+			free(buf);
+		}
+		unlock_fd(fd);
+	}
+	time_call(&stats.fwrite, start);
+	return written;
+}
+
+/* 
+ * reads from the read pointer into the buffers of iov, filling each before
+ * the next, as one read.
+ * returns the number of bytes read (less than asked at the end of file, 0 if
+ * the buffers are all empty, without looking at the fd), or -1 on error.
+ */
+int ssfs_freadv(int fileID, const struct iovec *iov, int iovcnt) {
+	int length = iov_length(iov, iovcnt);
+	if (length < 0) {
+		fprintf(stderr, "Error: Invalid read vector\n");
+		return -1;
+	}
+	if (length == 0)
+		return 0;
+
+	long start = now_ns();
+	int nread = -1;
+	fd_entry_t *fd = lock_fd(fileID, 0);
+	if (fd != NULL) {
+		char *buf = iov_single(iov, iovcnt);
+		if (buf != NULL) {
+			nread = fread_locked(fileID, buf, length, &fd->read_ptr);
+		} else {
+			buf = (char*)malloc(length);
+			nread = fread_locked(fileID, buf, length, &fd->read_ptr);
+			for (int i = 0, off = 0; i < iovcnt && off < nread; off += iov[i].iov_len, i++)
+				memcpy(iov[i].iov_base, buf + off, nread - off < (int)iov[i].iov_len ? nread - off : (int)iov[i].iov_len);
+			free(buf);
+		}
+		unlock_fd(fd);
+	}
+	time_call(&stats.fread, start);
+	return nread;
+}
+
+/* 
+ * writes length bytes of buf at offset, which must be within the file or
+ * at its end. the write pointer does not move.
+ * returns the number of bytes written, or -1 on error.
+ */
+int ssfs_pwrite(int fileID, char *buf, int length, int offset) {
+	long start = now_ns();
+	int written = -1;
+	fd_entry_t *fd = lock_fd(fileID, 1);
+	if (fd != NULL) {
+		int size = dir->files[fd->inode_no].size;
+		if (offset < 0 || offset > size)
+			fprintf(stderr, "Error: Cannot write at %d; file size is %d\n", offset, size);
+		else
+			written = fwrite_locked(fileID, buf, length, &offset);
+		unlock_fd(fd);
+	}
+	time_call(&stats.fwrite, start);
+	return written;
+}
+
+/* 
+ * reads up to length bytes at offset into buf. the read pointer does not
+ * move, so threads sharing an fd need no seeks.
+ * returns the number of bytes read (0 at the end of file), or -1 on error.
+ */
+int ssfs_pread(int fileID, char *buf, int length, int offset) {
+	long start = now_ns();
+	int nread = -1;
+	fd_entry_t *fd = lock_fd(fileID, 0);
+	if (fd != NULL) {
+		int size = dir->files[fd->inode_no].size;
+		if (offset < 0 || offset > size)
+			fprintf(stderr, "Error: Cannot read at %d; file size is %d\n", offset, size);
+		else
+			nread = fread_locked(fileID, buf, length, &offset);
+		unlock_fd(fd);
+	}
+	time_call(&stats.fread, start);
+	return nread;
+}
+
+/* 
+ * Read-ahead: each fd remembers the block where a sequential read would
+ * start. While reads keep starting there, the blocks of the request and
+ * a window past it are brought into the cache, and the window doubles on
+ * every read up to MAX_READAHEAD_BLOCKS. The window is only topped up
+ * once the reads have used half of it, so it is fetched in large runs
+ * rather than a block per read. Any other access turns read-ahead off
+ * until reads are sequential again.
+ */
+static void read_ahead(int fileID, int first, int last) {
+	fd_entry_t *fd = &ofdt->entries[fileID];
+	if (first != fd->ra_next) {
+		fd->ra_window = 0;
+		fd->ra_end = 0;
+		return;
+	}
+
+	fd->ra_window = fd->ra_window == 0 ? MIN_READAHEAD_BLOCKS : 2 * fd->ra_window;
+	if (fd->ra_window > MAX_READAHEAD_BLOCKS)
+		fd->ra_window = MAX_READAHEAD_BLOCKS;
+
+	if (fd->ra_end > last + fd->ra_window / 2)
+		return;
+
+	int file_blocks = bytes_to_blocks_rnd_up(dir->files[fd->inode_no].size);
+	int to = last + fd->ra_window < file_blocks ? last + fd->ra_window : file_blocks - 1;
+	int i = fd->ra_end > first ? fd->ra_end : first;
+
+	// one prefetch per physically contiguous run, blocks already cached are skipped
+	while (i <= to) {
+		int phys = bmap(fileID, i);
+		if (phys == -1)
+			break;
+		int n = contiguous_run(fileID, i, to);
+		if (cache_prefetch(phys, n) < 0)
+			break;
+		i += n;
+	}
+	fd->ra_end = i;
+}
+
+/* 
+ * removes the file and all associated data:
+ * 	- removes entry from the directory
+ *	- removes i-node pointing to the file's data blocks
+ *	- sets the occupied data blocks to free in the FBM
+ * directories are removed with ssfs_rmdir.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_remove(char *file) {
+	long start = now_ns();
+	int ret = remove_file(file);
+	time_call(&stats.remove, start);
+	return ret;
+}
+
+static int remove_file(char *path) {
+	char name[SSFS_MAX_NAME + 1];
+	int parent;
+
+	pthread_rwlock_rdlock(&commit_lock);
+	pthread_rwlock_wrlock(&dir_lock);
+	if (resolve_parent(path, &parent, name) != 0) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		return -1;
+	}
+	int file_exists = name_index_find(parent, name);
+
+	if (dir->full == 0) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: There are no files in the file system\n");
+		return -1;
+	}
+	if (file_exists == -1) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: Could not find the file '%s' in the file system\n", path);
+		return -1;
+	}
+	if (dir_entries[file_exists].is_dir) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: '%s' is a directory; use ssfs_rmdir\n", path);
+		return -1;
+	}
+
+	// free blocks associated with inode, then the map blocks that pointed to them
+	pthread_rwlock_wrlock(&inode_locks[file_exists]);
+	lock_meta();
+	inode_t *inode = get_inode(file_exists);
+	for (int i = 0; i < NUM_DIRECT_BLOCKS; i++) {
+		if (inode->direct[i] == -1)
+			continue;
+		free_block(inode->direct[i]);
+		inode->direct[i] = -1;
+	}
+
+	int had_maps = inode->indirect != -1 || inode->double_indirect != -1;
+	int *ptrs = (int*)malloc(block_size);
+	int *leaf = (int*)malloc(block_size);
+	if (inode->indirect != -1) {
+		read_meta_block(inode->indirect, ptrs);
+		for (int i = 0; i < ptrs_per_block; i++)
+			if (ptrs[i] != -1)
+				free_block(ptrs[i]);
+		free_block(inode->indirect);
+		inode->indirect = -1;
+	}
+	if (inode->double_indirect != -1) {
+		read_meta_block(inode->double_indirect, ptrs);
+		for (int i = 0; i < ptrs_per_block; i++) {
+			if (ptrs[i] == -1)
+				continue;
+			read_meta_block(ptrs[i], leaf);
+			for (int j = 0; j < ptrs_per_block; j++)
+				if (leaf[j] != -1)
+					free_block(leaf[j]);
+			free_block(ptrs[i]);
+		}
+		free_block(inode->double_indirect);
+		inode->double_indirect = -1;
+	}
+	free(ptrs);
+	free(leaf);
+
+	// open fds of the file are closed: the inode goes to the next file created
+	for (int i = 0; i < MAX_OPEN_FILES; i++) {
+		if (__atomic_load_n(&ofdt->entries[i].inode_no, __ATOMIC_ACQUIRE) != file_exists)
+			continue;
+		drop_maps(i);
+		__atomic_store_n(&ofdt->entries[i].inode_no, -1, __ATOMIC_RELEASE);
+		__atomic_sub_fetch(&ofdt->full, 1, __ATOMIC_RELEASE);
+	}
+
+	free_entry(file_exists);
+	sync_metadata();
+
+	// the journal still holds images of the freed map blocks; write them home
+	// now so a later replay cannot put them over blocks that get reused
+	if (had_maps && use_journal)
+		journal_checkpoint();
+
+	unlock_meta();
+	pthread_rwlock_unlock(&inode_locks[file_exists]);
+	pthread_rwlock_unlock(&dir_lock);
+	pthread_rwlock_unlock(&commit_lock);
+    return 0;
+}
+
+/* 
+ * creates a directory. the directories on its path must exist.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_mkdir(char *path) {
+	char name[SSFS_MAX_NAME + 1];
+	int parent;
+
+	pthread_rwlock_rdlock(&commit_lock);
+	pthread_rwlock_wrlock(&dir_lock);
+	int ret = resolve_parent(path, &parent, name);
+	if (ret == 0 && name_index_find(parent, name) != -1) {
+		fprintf(stderr, "Error: '%s' already exists\n", path);
+		ret = -1;
+	}
+	if (ret == 0 && create_entry(parent, name, 1) == -1)
+		ret = -1;
+	pthread_rwlock_unlock(&dir_lock);
+	pthread_rwlock_unlock(&commit_lock);
+	return ret;
+}
+
+/* 
+ * removes an empty directory.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_rmdir(char *path) {
+	char name[SSFS_MAX_NAME + 1];
+	int parent;
+
+	pthread_rwlock_rdlock(&commit_lock);
+	pthread_rwlock_wrlock(&dir_lock);
+	if (resolve_parent(path, &parent, name) != 0) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		return -1;
+	}
+	int ino = name_index_find(parent, name);
+	if (ino == -1 || !dir_entries[ino].is_dir) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: No directory '%s'\n", path);
+		return -1;
+	}
+	if (dir->files[ino].size != 0) {
+		pthread_rwlock_unlock(&dir_lock);
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: Directory '%s' is not empty\n", path);
+		return -1;
+	}
+
+	lock_meta();
+	free_entry(ino);
+	sync_metadata();
+	unlock_meta();
+
+	// cached paths may lead to it; its inode can become another directory
+	path_cache_clear();
+
+	pthread_rwlock_unlock(&dir_lock);
+	pthread_rwlock_unlock(&commit_lock);
+	return 0;
+}
+
+// adds delta to the number of entries of directory parent
+static void count_entry(int parent, int delta) {
+	if (parent == ROOT_DIR)
+		return;
+	get_inode(parent)->size += delta;
+	mark_inode_dirty(parent);
+}
+
+/* 
+ * gives a new file (is_dir = 0) or directory an inode and an entry named
+ * name in directory parent. call with dir_lock held for writing.
+ * returns the inode number, or -1 on error.
+ */
+static int create_entry(int parent, char *name, int is_dir) {
+	if (dir->full == max_inodes) {
+		fprintf(stderr, "Error: Too many files in the file system (max = %d); cannot create a new file.\n", max_inodes);
+		return -1;
+	}
+
+	lock_meta();
+	int ino = get_next_free_dir();
+	if (map_dir_blocks(&dir->files[ino], sizeof(inode_t)) != 0
+			|| map_dir_blocks(&dir_entries[ino], sizeof(dir_entry_t)) != 0) {
+		unlock_meta();
+		fprintf(stderr, "Error: Filesystem too full to create a file\n");
+		return -1;
+	}
+	set_inode_used(ino, 1);
+	get_inode(ino)->size = 0;
+	// no blocks associated with file yet -- don't adjust direct[i] pointers
+
+	dir_entries[ino].inode_no = ino;
+	strcpy(dir_entries[ino].filename, name);
+	dir_entries[ino].is_dir = is_dir;
+	dir_entries[ino].parent = parent;
+	dir->full++;
+	name_index_insert(ino);
+	count_entry(parent, 1);
+
+	mark_inode_dirty(ino);
+	mark_dir_dirty(dir, 2 * sizeof(int)); // full
+	sync_metadata();
+	unlock_meta();
+	return ino;
+}
+
+// marks inode ino and its entry as free; its blocks must be freed already. call with meta_lock held
+static void free_entry(int ino) {
+	name_index_remove(ino);
+	count_entry(dir_entries[ino].parent, -1);
+	dir->files[ino].size = -1;
+	dir_entries[ino].inode_no = -1;
+	dir_entries[ino].filename[0] = '\0';
+	dir_entries[ino].is_dir = 0;
+	dir->full--;
+	set_inode_used(ino, 0);
+
+	mark_inode_dirty(ino);
+	mark_dir_dirty(dir, 2 * sizeof(int)); // full
+}
+
+/* 
+ * writes every dirty cached block back to disk.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_flush() {
+	lock_meta();
+	pending_ops = 0;
+	int ret = journal_commit() == 0 ? cache_flush() : -1;
+	unlock_meta();
+	return ret;
+}
+
+/* 
+ * picks how the next mkssfs/mkssfs_format opens the image: SSFS_BACKEND_MMAP
+ * (the default) maps it, so blocks are memcpys and async requests are done
+ * by whoever reaps them; SSFS_BACKEND_PIO uses pread/pwrite, and async
+ * requests are in flight on the I/O engine.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_set_backend(int backend) {
+	if (backend != SSFS_BACKEND_PIO && backend != SSFS_BACKEND_MMAP) {
+		fprintf(stderr, "Error: Unknown backend %d\n", backend);
+		return -1;
+	}
+	disk_backend = backend == SSFS_BACKEND_PIO ? DISK_BACKEND_PIO : DISK_BACKEND_MMAP;
+	return 0;
+}
+
+/* 
+ * sets how many blocks the write-back cache may hold (0 disables it).
+ * takes effect immediately if mounted, dirty blocks are written back first.
+ * like mkssfs, no other thread may be using the file system meanwhile.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_set_cache_size(int nblocks) {
+	if (nblocks < 0) {
+		fprintf(stderr, "Error: Cache size cannot be negative\n");
+		return -1;
+	}
+	cache_blocks = nblocks;
+	if (ofdt == NULL)
+		return 0;
+	return cache_init(cache_blocks, block_size);
+}
+
+/* 
+ * Snapshots. A snapshot is a frozen copy of the dir: shadow[i] is laid out
+ * like a file (direct, indirect and double-indirect blocks) whose logical
+ * blocks are the blocks of the dir as they were at that commit. Every block
+ * in use when a commit is made gets its WM bit cleared (frozen); the live
+ * file system never writes a frozen block again but copies it first
+ * (data blocks in ssfs_fwrite, map blocks in bmap_set), and freeing one
+ * leaves it reserved. So a snapshot costs:
+ *	- on commit, a copy of the dir blocks changed since the last commit
+ *	  (shared with the previous snapshot otherwise) and a pass over the WM
+ *	- on restore, reading the snapshot's dir back and freeing the blocks
+ *	  written since (the used ones that are not frozen)
+ * Frozen blocks no snapshot holds anymore (after the oldest is dropped)
+ * are only found by sweep_frozen(), run when a write runs out of space.
+ */
+
+// returns the block holding logical block lblk of a snapshot, or -1
+static int snap_map_get(inode_t *root, int lblk) {
+	int *ptrs = (int*)malloc(block_size);
+	int ret = -1;
+	if (lblk < NUM_DIRECT_BLOCKS) {
+		ret = root->direct[lblk];
+	} else if ((lblk -= NUM_DIRECT_BLOCKS) < ptrs_per_block) {
+		if (root->indirect != -1) {
+			read_meta_block(root->indirect, ptrs);
+			ret = ptrs[lblk];
+		}
+	} else if (root->double_indirect != -1) {
+		lblk -= ptrs_per_block;
+		read_meta_block(root->double_indirect, ptrs);
+		int leaf = ptrs[lblk / ptrs_per_block];
+		if (leaf != -1) {
+			read_meta_block(leaf, ptrs);
+			ret = ptrs[lblk % ptrs_per_block];
+		}
+	}
+	free(ptrs);
+	return ret;
+}
+
+/* 
+ * loads map block *block into ptrs, first moving it to a new block (near
+ * goal) if it is frozen, or giving it one with every pointer unset if it is -1.
+ * returns 0 on success, -1 if the disk is full.
+ */
+static int own_map_block(int *block, int goal, int *ptrs) {
+	if (*block == -1) {
+		for (int i = 0; i < ptrs_per_block; i++)
+			ptrs[i] = -1;
+	} else {
+		read_meta_block(*block, ptrs);
+		if (!frozen(*block))
+			return 0;
+	}
+
+	int got;
+	int copy = alloc_extent(goal, 1, &got);
+	if (copy == -1)
+		return -1;
+	*block = copy;
+	return 0;
+}
+
+// points logical block lblk of a snapshot being built to phys; returns 0, or -1 if the disk is full
+static int snap_map_set(inode_t *root, int lblk, int phys) {
+	if (lblk < NUM_DIRECT_BLOCKS) {
+		root->direct[lblk] = phys;
+		return 0;
+	}
+
+	int *ptrs = (int*)malloc(block_size);
+	int ret = -1;
+	lblk -= NUM_DIRECT_BLOCKS;
+	if (lblk < ptrs_per_block) {
+		if (own_map_block(&root->indirect, phys + 1, ptrs) == 0) {
+			ptrs[lblk] = phys;
+			write_meta_block(root->indirect, ptrs);
+			ret = 0;
+		}
+		free(ptrs);
+		return ret;
+	}
+
+	lblk -= ptrs_per_block;
+	int *leaf = (int*)malloc(block_size);
+	if (own_map_block(&root->double_indirect, phys + 1, ptrs) == 0 &&
+		own_map_block(&ptrs[lblk / ptrs_per_block], phys + 1, leaf) == 0) {
+		leaf[lblk % ptrs_per_block] = phys;
+		write_meta_block(ptrs[lblk / ptrs_per_block], leaf);
+		write_meta_block(root->double_indirect, ptrs);
+		ret = 0;
+	}
+	free(leaf);
+	free(ptrs);
+	return ret;
+}
+
+// bits of FBM/WM word w that belong to the data area (after the IBM, before the FBM)
+static uint64_t data_area_bits(int w) {
+	int lo = data_start;
+	uint64_t bits = ~(uint64_t)0;
+	if (w == lo / 64)
+		bits &= ~(uint64_t)0 << (lo % 64);
+	if (w == fbm_start / 64)
+		bits &= ((uint64_t)1 << (fbm_start % 64)) - 1;
+	return bits;
+}
+
+// freezes every block of the data area in use now: WM &= FBM, one word at a time
+static void freeze_in_use() {
+	pthread_mutex_lock(&alloc_lock);
+	for (int w = data_start / 64; w <= (fbm_start - 1) / 64; w++) {
+		uint64_t wm = WM[w] & (FBM[w] | ~data_area_bits(w));
+		if (wm != WM[w]) {
+			__atomic_store_n(&WM[w], wm, __ATOMIC_RELAXED);	// see frozen()
+			mark_wm_dirty(w * 64);
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+/* 
+ * takes a snapshot of the file system. the oldest snapshot is dropped
+ * once NUM_SHADOWS are kept (never the one the live dir came from).
+ * returns the snapshot's commit number (> 0), or -1 on error.
+ */
+int ssfs_commit() {
+	pthread_rwlock_wrlock(&commit_lock);
+	lock_meta();
+	load_dir(dir, dir_blocks * block_size);
+
+	int base = superblock->last_shadow;
+	if (base >= 0 && superblock->shadow_cnum[base] == 0)
+		base = -1;
+
+	// an empty slot, or the oldest snapshot
+	int slot = -1;
+	for (int i = 0; i < NUM_SHADOWS; i++) {
+		if (i == base)
+			continue;
+		if (slot == -1 || superblock->shadow_cnum[i] < superblock->shadow_cnum[slot])
+			slot = i;
+	}
+	if (superblock->shadow_cnum[slot] != 0) {
+		superblock->shadow_cnum[slot] = 0;
+		frozen_released = 1;
+	}
+
+	// the new snapshot shares every dir block that did not change with its base
+	inode_t root;
+	if (base >= 0) {
+		root = superblock->shadow[base];
+	} else {
+		root.size = dir_blocks * block_size;
+		root.indirect = root.double_indirect = -1;
+		for (int i = 0; i < NUM_DIRECT_BLOCKS; i++)
+			root.direct[i] = -1;
+	}
+
+	// room for every changed dir block, plus a copy of each map block on the way to it;
+	// blocks no inode was ever created in stay unset in the snapshot too
+	int changed = 0;
+	for (int i = 0; i < dir_blocks; i++)
+		if ((dir_changed[i] != 0 || base < 0) && dir_block_phys(i) != -1)
+			changed++;
+	pthread_mutex_lock(&alloc_lock);
+	int free_blocks = fbm_free;
+	pthread_mutex_unlock(&alloc_lock);
+	if (2 * changed + 2 > free_blocks && frozen_released) {
+		sweep_frozen();
+		pthread_mutex_lock(&alloc_lock);
+		free_blocks = fbm_free;
+		pthread_mutex_unlock(&alloc_lock);
+	}
+	if (2 * changed + 2 > free_blocks) {
+		unlock_meta();
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: Filesystem too full to commit\n");
+		return -1;
+	}
+
+	char *old = (char*)malloc(block_size);
+	int ret = 0;
+	int prev = -1;
+	for (int i = 0; i < dir_blocks && ret == 0; i++) {
+		char *live = (char*)dir + (size_t)i * block_size;
+		if (dir_block_phys(i) == -1)
+			continue;
+		int copy = base >= 0 ? snap_map_get(&root, i) : -1;
+		if (copy != -1 && dir_changed[i] == 0)
+			continue;
+		if (copy != -1 && dir_changed[i] == 2) {
+			read_meta_block(copy, old);
+			if (memcmp(old, live, block_size) == 0)
+				continue;
+		}
+
+		int got;
+		copy = alloc_extent(prev != -1 ? prev + 1 : -1, 1, &got);
+		if (copy == -1 || snap_map_set(&root, i, copy) != 0)
+			ret = -1;
+		else
+			write_meta_block(copy, live);
+		prev = copy;
+	}
+	free(old);
+
+	if (ret != 0) {
+		unlock_meta();
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: Filesystem too full to commit\n");
+		return -1;
+	}
+
+	freeze_in_use();
+	superblock->shadow[slot] = root;
+	superblock->shadow_cnum[slot] = ++superblock->commits;
+	superblock->last_shadow = slot;
+	write_superblock();
+	memset(dir_changed, 0, dir_blocks);
+
+	sync_metadata();
+	pending_ops = 0;
+	ret = journal_commit() == 0 ? superblock->commits : -1;
+	unlock_meta();
+	pthread_rwlock_unlock(&commit_lock);
+	return ret;
+}
+
+/* 
+ * brings the file system back to snapshot cnum. open files the snapshot
+ * has stay open (pointers past the old end of file move back to it);
+ * fds of files the snapshot does not have are closed.
+ * returns 0 on success, -1 on error.
+ */
+int ssfs_restore(int cnum) {
+	pthread_rwlock_wrlock(&commit_lock);
+	lock_meta();
+
+	int slot = -1;
+	for (int i = 0; i < NUM_SHADOWS; i++)
+		if (cnum > 0 && superblock->shadow_cnum[i] == cnum)
+			slot = i;
+	if (slot == -1) {
+		unlock_meta();
+		pthread_rwlock_unlock(&commit_lock);
+		fprintf(stderr, "Error: No snapshot with commit number %d\n", cnum);
+		return -1;
+	}
+
+	// background writes must not land on blocks freed below
+	disk_aio_drain();
+
+	// every used block of the data area that is not frozen was written after the last commit
+	pthread_mutex_lock(&alloc_lock);
+	for (int w = data_start / 64; w <= (fbm_start - 1) / 64; w++) {
+		uint64_t fbm = FBM[w] | (WM[w] & data_area_bits(w));
+		if (fbm != FBM[w]) {
+			FBM[w] = fbm;
+			mark_fbm_dirty(w * 64);
+		}
+	}
+	pthread_mutex_unlock(&alloc_lock);
+	fbm_count_free();
+
+	// names of the open files, to tell a file from another one that got its inode since
+	load_dir(dir, dir_blocks * block_size);
+	dir_entry_t *names = (dir_entry_t*)malloc(max_inodes * sizeof(dir_entry_t));
+	memcpy(names, dir_entries, max_inodes * sizeof(dir_entry_t));
+
+	inode_t *root = &superblock->shadow[slot];
+	for (int i = 0; i < dir_blocks; i++) {
+		int copy = snap_map_get(root, i);
+		if (copy == -1)
+			init_dir_block((char*)dir, i);
+		else
+			read_meta_block(copy, (char*)dir + (size_t)i * block_size);
+	}
+
+	// the dir blocks are where they were at that commit (root.blks is the j-node)
+	superblock->root = dir->files[0];
+	memset(dir_phys, 0, dir_blocks * sizeof(int));
+	for (int i = 0; i < dir_blocks; i++)
+		if (dir_block_phys(i) != -1)
+			mark_dir_dirty((char*)dir + (size_t)i * block_size, block_size);
+	memset(dir_changed, 0, dir_blocks);
+
+	memset(IBM, 0, ibm_words * sizeof(uint64_t));
+	for (int i = 0; i < max_inodes; i++)
+		if (dir_entries[i].inode_no == -1)
+			setBit(IBM, i);
+	memset(ibm_dirty, 1, ibm_blocks);
+	ibm_cursor = 0;
+	name_index_build();
+	path_cache_clear();
+
+	// open fds follow their file into the snapshot
+	for (int i = 0; i < MAX_OPEN_FILES; i++) {
+		fd_entry_t *fd = &ofdt->entries[i];
+		if (fd->inode_no == -1)
+			continue;
+		drop_maps(i);
+		fd->ra_next = fd->ra_window = fd->ra_end = 0;
+		fd->inode = dir->files[fd->inode_no];
+		if (fd->inode.size == -1 || dir_entries[fd->inode_no].inode_no == -1 ||
+			dir_entries[fd->inode_no].parent != names[fd->inode_no].parent ||
+			strcmp(dir_entries[fd->inode_no].filename, names[fd->inode_no].filename) != 0) {
+			__atomic_store_n(&fd->inode_no, -1, __ATOMIC_RELEASE);
+			__atomic_sub_fetch(&ofdt->full, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		if (fd->read_ptr > fd->inode.size)
+			fd->read_ptr = fd->inode.size;
+		if (fd->write_ptr > fd->inode.size)
+			fd->write_ptr = fd->inode.size;
+	}
+	free(names);
+
+	superblock->last_shadow = slot;
+	write_superblock();
+	sync_metadata();
+	pending_ops = 0;
+
+	// the journal may hold images of map blocks just freed; write them home before they are reused
+	int ret = journal_checkpoint() == 0 ? 0 : -1;
+	unlock_meta();
+	pthread_rwlock_unlock(&commit_lock);
+	return ret;
+}
+
+// sets the bits of every block a file (or a snapshot root) points to, map blocks included
+static void mark_tree(inode_t *inode, uint64_t *used, int *ptrs, int *leaf) {
+	for (int i = 0; i < NUM_DIRECT_BLOCKS; i++)
+		if (inode->direct[i] != -1)
+			setBit(used, inode->direct[i]);
+	if (inode->indirect != -1) {
+		setBit(used, inode->indirect);
+		read_meta_block(inode->indirect, ptrs);
+		for (int i = 0; i < ptrs_per_block; i++)
+			if (ptrs[i] != -1)
+				setBit(used, ptrs[i]);
+	}
+	if (inode->double_indirect != -1) {
+		setBit(used, inode->double_indirect);
+		read_meta_block(inode->double_indirect, ptrs);
+		for (int i = 0; i < ptrs_per_block; i++) {
+			if (ptrs[i] == -1)
+				continue;
+			setBit(used, ptrs[i]);
+			read_meta_block(ptrs[i], leaf);
+			for (int j = 0; j < ptrs_per_block; j++)
+				if (leaf[j] != -1)
+					setBit(used, leaf[j]);
+		}
+	}
+}
+
+/* 
+ * frees the frozen blocks that neither the live file system nor any kept
+ * snapshot points to anymore. walks every file of the live dir and of each
+ * snapshot's dir, so it only runs when a write would fail without it.
+ */
+static void sweep_frozen() {
+	lock_meta();
+	uint64_t *used = (uint64_t*)calloc(fbm_words, sizeof(uint64_t));
+	int *ptrs = (int*)malloc(block_size);
+	int *leaf = (int*)malloc(block_size);
+	directory_t *image = (directory_t*)malloc((size_t)dir_blocks * block_size);
+
+	load_dir(dir, dir_blocks * block_size);
+	for (int i = 0; i < max_inodes; i++)
+		if (dir->files[i].size != -1)
+			mark_tree(&dir->files[i], used, ptrs, leaf);
+
+	for (int s = 0; s < NUM_SHADOWS; s++) {
+		if (superblock->shadow_cnum[s] == 0)
+			continue;
+		mark_tree(&superblock->shadow[s], used, ptrs, leaf);
+		for (int i = 0; i < dir_blocks; i++) {
+			int copy = snap_map_get(&superblock->shadow[s], i);
+			if (copy == -1)
+				init_dir_block((char*)image, i);
+			else
+				read_meta_block(copy, (char*)image + (size_t)i * block_size);
+		}
+		for (int i = 0; i < max_inodes; i++)
+			if (image->files[i].size != -1)
+				mark_tree(&image->files[i], used, ptrs, leaf);
+	}
+
+	int freed = 0;
+	pthread_mutex_lock(&alloc_lock);
+	for (int b = data_start; b < fbm_start; b++) {
+		if (getBit(WM, b) || getBit(used, b))
+			continue;
+		__atomic_or_fetch(&WM[b / 64], (uint64_t)1 << (b % 64), __ATOMIC_RELAXED);	// see frozen()
+		setBit(FBM, b);
+		mark_wm_dirty(b);
+		mark_fbm_dirty(b);
+		fbm_free++;
+		freed++;
+	}
+	pthread_mutex_unlock(&alloc_lock);
+	frozen_released = 0;
+
+	free(used);
+	free(ptrs);
+	free(leaf);
+	free(image);
+
+	sync_metadata();
+	if (freed > 0 && use_journal)
+		journal_checkpoint();
+	unlock_meta();
+}
+
+/* 
+ * Statistics. Counters are bumped with relaxed atomic adds where the work
+ * happens, and each public call is timed with one clock read on entry
+ * and one on exit into a power-of-two histogram, so they stay on. Disk
+ * and cache counters are kept by disk_emu and the block cache and are
+ * copied in by ssfs_get_stats.
+ */
+static long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// adds a call that started at `start` (from now_ns) to a histogram
+static void time_call(ssfs_latency_t *lat, long start) {
+	long ns = now_ns() - start;
+	int bucket = ns > 0 ? 63 - __builtin_clzl(ns) : 0;
+	if (bucket >= SSFS_LATENCY_BUCKETS)
+		bucket = SSFS_LATENCY_BUCKETS - 1;
+	__atomic_add_fetch(&lat->calls, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&lat->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&lat->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+// copies the counters into out; the copy is not one atomic snapshot
+void ssfs_get_stats(ssfs_stats_t *out) {
+	long *from = (long*)&stats;
+	long *to = (long*)out;
+	for (size_t i = 0; i < sizeof(ssfs_stats_t) / sizeof(long); i++)
+		to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+
+	disk_stats_t disk;
+	disk_get_stats(&disk);
+	out->disk_reads = disk.reads;
+	out->disk_writes = disk.writes;
+	out->blocks_read = disk.blocks_read;
+	out->blocks_written = disk.blocks_written;
+
+	cache_stats_t cache;
+	cache_get_stats(&cache);
+	out->cache_hits = cache.hits;
+	out->cache_misses = cache.misses;
+}
+
+void ssfs_reset_stats() {
+	long *counters = (long*)&stats;
+	for (size_t i = 0; i < sizeof(ssfs_stats_t) / sizeof(long); i++)
+		__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+	disk_reset_stats();
+	cache_reset_stats();
+}
+
+// upper bound, in microseconds, of the bucket holding quantile q of the calls
+static double latency_quantile(ssfs_latency_t *lat, double q) {
+	long seen = 0;
+	for (int i = 0; i < SSFS_LATENCY_BUCKETS; i++) {
+		seen += lat->buckets[i];
+		if (seen > 0 && seen >= q * lat->calls)
+			return (double)(2L << i) / 1000;
+	}
+	return 0;
+}
+
+static void dump_latency(const char *name, ssfs_latency_t *lat) {
+	printf("%-8s calls %-9ld mean_us %-9.1f p50_us <%-9.1f p99_us <%-9.1f p999_us <%.1f\n", name, lat->calls,
+		lat->calls > 0 ? (double)lat->total_ns / lat->calls / 1000 : 0.0,
+		latency_quantile(lat, 0.5), latency_quantile(lat, 0.99), latency_quantile(lat, 0.999));
+}
+
+// prints every counter and the latency of each call to stdout
+void ssfs_dump_stats() {
+	ssfs_stats_t s;
+	ssfs_get_stats(&s);
+	printf("disk     reads %ld (%ld blocks) writes %ld (%ld blocks)\n", s.disk_reads, s.blocks_read, s.disk_writes, s.blocks_written);
+	printf("bytes    read %ld written %ld\n", s.bytes_read, s.bytes_written);
+	printf("cache    hits %ld misses %ld\n", s.cache_hits, s.cache_misses);
+	printf("rmw      blocks %ld\n", s.rmw_blocks);
+	printf("meta     syncs %ld blocks %ld\n", s.meta_syncs, s.meta_blocks);
+	printf("alloc    calls %ld words_scanned %ld\n", s.allocs, s.alloc_words);
+	printf("paths    cache_hits %ld walked %ld\n", s.path_hits, s.path_misses);
+	dump_latency("fopen", &s.fopen);
+	dump_latency("fread", &s.fread);
+	dump_latency("fwrite", &s.fwrite);
+	dump_latency("remove", &s.remove);
+}
+
+/* 
+ * Asynchronous reads and writes. Everything that touches the file system
+ * state (pointers, block maps, sizes, the cache) is done when the request
+ * is submitted, in order with the other calls; only the disk transfers
+ * are left in flight:
+ *	- reads copy cached blocks right away and fetch the others from disk
+ *	- writes go into the cache like ssfs_fwrite, and the blocks they
+ *	  dirtied are written back in the background
+ * Callbacks run inside ssfs_progress/ssfs_poll/ssfs_wait, on the thread
+ * that called it.
+ */
+static void request_put(ssfs_req_t *req) {
+	pthread_mutex_lock(&req_lock);
+	if (--req->pending == 0) {
+		req->complete = 1;
+		pthread_cond_broadcast(&req_cond);
+		if (req->done != NULL) {
+			req->next = NULL;
+			if (ready_tail == NULL)
+				ready_head = req;
+			else
+				ready_tail->next = req;
+			ready_tail = req;
+		}
+	}
+	pthread_mutex_unlock(&req_lock);
+}
+
+static void request_io_done(disk_io_t *io) {
+	req_io_t *rio = (req_io_t*)io->arg;
+	if (io->result != io->nblocks) {
+		pthread_mutex_lock(&req_lock);
+		rio->req->result = -1;
+		pthread_mutex_unlock(&req_lock);
+	} else if (io->op == DISK_IO_READ)
+		memcpy(rio->dest, rio->data + rio->skip, rio->len);
+	else
+		for (int i = 0; i < io->nblocks; i++)
+			cache_mark_clean(io->start_address + i, rio->gens[i]);
+
+	ssfs_req_t *req = rio->req;
+	free(rio->data);
+	free(rio->gens);
+	free(rio);
+	request_put(req);
+}
+
+// a transfer of nblocks at block for req, with a buffer for them
+static req_io_t *new_req_io(ssfs_req_t *req, int op, int block, int nblocks) {
+	req_io_t *rio = (req_io_t*)calloc(1, sizeof(req_io_t));
+	rio->req = req;
+	rio->data = (char*)malloc((size_t)nblocks * block_size);
+	rio->io.op = op;
+	rio->io.start_address = block;
+	rio->io.nblocks = nblocks;
+	rio->io.buffer = rio->data;
+	rio->io.done = request_io_done;
+	rio->io.arg = rio;
+	return rio;
+}
+
+static void submit_req_io(req_io_t *rio) {
+	ssfs_req_t *req = rio->req;
+	pthread_mutex_lock(&req_lock);
+	req->pending++;
+	pthread_mutex_unlock(&req_lock);
+	if (submit_blocks(&rio->io) != 0) {
+		pthread_mutex_lock(&req_lock);
+		req->result = -1;
+		req->pending--;
+		pthread_mutex_unlock(&req_lock);
+		free(rio->data);
+		free(rio->gens);
+		free(rio);
+	}
+}
+
+static ssfs_req_t *new_request(ssfs_callback_t done, void *arg) {
+	pthread_mutex_lock(&req_lock);
+	if (disk_aio_engine() == DISK_AIO_NONE)
+		disk_aio_init(ASYNC_QUEUE_DEPTH, DISK_AIO_URING);
+	pthread_mutex_unlock(&req_lock);
+
+	ssfs_req_t *req = (ssfs_req_t*)calloc(1, sizeof(ssfs_req_t));
+	req->pending = 1;
+	req->done = done;
+	req->arg = arg;
+	return req;
+}
+
+/* 
+ * starts reading like ssfs_fread; the read pointer moves right away.
+ * if done is given it is called once the bytes are in buf, and the request
+ * is freed after it returns; otherwise collect it with ssfs_wait.
+ * returns the request, or NULL on error.
+ */
+ssfs_req_t *ssfs_fread_async(int fileID, char *buf, int length, ssfs_callback_t done, void *arg) {
+	fd_entry_t *fd = lock_fd(fileID, 0);
+	if (fd == NULL)
+		return NULL;
+	if (length <= 0) {
+		unlock_fd(fd);
+		fprintf(stderr, "Error: Cannot read less than or 0 bytes\n");
+		return NULL;
+	}
+
+	inode_t *inode = &dir->files[ofdt->entries[fileID].inode_no];
+	int start = ofdt->entries[fileID].read_ptr;
+	int end = start + length < inode->size ? start + length : inode->size;
+	int first = start / block_size;
+	int last = (end - 1) / block_size;
+
+	for (int i = first; i <= last && end > start; i++) {
+		if (bmap(fileID, i) == -1) {
+			unlock_fd(fd);
+			fprintf(stderr, "Error: read pointer points to an empty block\n");
+			return NULL;
+		}
+	}
+
+	ssfs_req_t *req = new_request(done, arg);
+	req->result = end > start ? end - start : 0;
+	STAT_ADD(bytes_read, req->result);
+	char *tmp = (char*)malloc(block_size);
+
+	for (int i = first; i <= last && end > start; ) {
+		int phys = bmap(fileID, i);
+		int block_start = i * block_size;
+		int from = start > block_start ? start : block_start;
+
+		// cached blocks may be newer than the disk: take them from the cache now
+		if (cache_contains(phys)) {
+			int to = end < block_start + block_size ? end : block_start + block_size;
+			cache_read(phys, 1, tmp);
+			memcpy(buf + (from - start), tmp + (from - block_start), to - from);
+			i++;
+			continue;
+		}
+
+		int n = 1;
+		while (n < MAX_IO_BLOCKS && i + n <= last && bmap(fileID, i + n) == phys + n && !cache_contains(phys + n))
+			n++;
+		int to = end < (i + n) * block_size ? end : (i + n) * block_size;
+
+		req_io_t *rio = new_req_io(req, DISK_IO_READ, phys, n);
+		rio->dest = buf + (from - start);
+		rio->skip = from - block_start;
+		rio->len = to - from;
+		submit_req_io(rio);
+		i += n;
+	}
+	free(tmp);
+
+	ofdt->entries[fileID].read_ptr = end > start ? end : start;
+	ofdt->entries[fileID].ra_next = ofdt->entries[fileID].read_ptr / block_size;
+	unlock_fd(fd);
+	request_put(req);
+	return req;
+}
+
+/* 
+ * writes like ssfs_fwrite, then writes the blocks it dirtied back to disk
+ * in the background. buf can be reused as soon as this returns. a block
+ * still being written back for an earlier call stays dirty in the cache
+ * and goes out with the next flush instead.
+ * if done is given it is called once the blocks are on disk, and the request
+ * is freed after it returns; otherwise collect it with ssfs_wait.
+ * returns the request, or NULL on error.
+ */
+ssfs_req_t *ssfs_fwrite_async(int fileID, char *buf, int length, ssfs_callback_t done, void *arg) {
+	fd_entry_t *fd = lock_fd(fileID, 1);
+	if (fd == NULL)
+		return NULL;
+	int written = fwrite_locked(fileID, buf, length, &fd->write_ptr);
+	if (written < 0) {
+		unlock_fd(fd);
+		return NULL;
+	}
+
+	ssfs_req_t *req = new_request(done, arg);
+	req->result = written;
+
+	int end = ofdt->entries[fileID].write_ptr;
+	int first = (end - written) / block_size;
+	int last = (end - 1) / block_size;
+
+	// blocks already written back (or never cached) need nothing more
+	for (int i = first; i <= last; ) {
+		int run = contiguous_run(fileID, i, last);
+		int phys = bmap(fileID, i);
+		req_io_t *rio = new_req_io(req, DISK_IO_WRITE, phys, run);
+		rio->gens = (unsigned int*)malloc(run * sizeof(unsigned int));
+
+		int n = 0;
+		while (n < run && cache_snapshot(phys + n, rio->data + (size_t)n * block_size, &rio->gens[n]))
+			n++;
+
+		if (n == 0) {
+			free(rio->data);
+			free(rio->gens);
+			free(rio);
+			i++;
+			continue;
+		}
+		rio->io.nblocks = n;
+		submit_req_io(rio);
+		i += n;
+	}
+
+	unlock_fd(fd);
+	request_put(req);
+	return req;
+}
+
+// runs the callbacks of the requests that completed; returns how many ran
+int ssfs_progress() {
+	disk_aio_poll();
+
+	int n = 0;
+	for (;;) {
+		pthread_mutex_lock(&req_lock);
+		ssfs_req_t *req = ready_head;
+		if (req != NULL) {
+			ready_head = req->next;
+			if (ready_head == NULL)
+				ready_tail = NULL;
+		}
+		pthread_mutex_unlock(&req_lock);
+		if (req == NULL)
+			return n;
+
+		req->done(req, req->result, req->arg);
+		free(req);
+		n++;
+	}
+}
+
+// returns 1 if the request (one without a callback) is complete, 0 otherwise
+int ssfs_poll(ssfs_req_t *req) {
+	ssfs_progress();
+	pthread_mutex_lock(&req_lock);
+	int complete = req->complete;
+	pthread_mutex_unlock(&req_lock);
+	return complete;
+}
+
+/* 
+ * waits for a request without a callback and frees it.
+ * returns the bytes read or written, or -1 on error.
+ */
+int ssfs_wait(ssfs_req_t *req) {
+	pthread_mutex_lock(&req_lock);
+	while (!req->complete) {
+		pthread_mutex_unlock(&req_lock);
+		int reaped = disk_aio_wait_any();
+		pthread_mutex_lock(&req_lock);
+
+		// nothing left in flight: another thread reaped the last transfer and is finishing it
+		if (reaped == 0 && !req->complete && disk_aio_inflight() == 0)
+			pthread_cond_wait(&req_cond, &req_lock);
+	}
+	int result = req->result;
+	pthread_mutex_unlock(&req_lock);
+	ssfs_progress();
+
+	free(req);
+	return result;
+}
+
+/* 
+ * Functions that interact with the FBM and WM, which are bit arrays 
+ * that use an array of 64-bit words for representation.
+ * 	- setBit: set bit at bit index i to 1
+ * 	- clrBit: set bit at bit index i to 0
+ * 	- getBit: get bit at bit index i
+ * adapted from http://www.mathcs.emory.edu/~cheung/Courses/255/Syllabus/1-C-intro/bit-array.html
+ */
+void setBit(uint64_t *bit_array, int i) {
+	int index = i / 64;
+	int bit_pos = i % 64;
+	uint64_t set = 1;	  // 00000000 ... 00000001
+	set = set << bit_pos; // bitwise shift left by x positions
+
+	bit_array[index] = bit_array[index] | set; // binary or
+}
+
+void clrBit(uint64_t *bit_array, int i) {
+	int index = i / 64;
+	int bit_pos = i % 64;
+	uint64_t set = 1;		  	// 00000000 ... 00000001
 	set = ~(set << bit_pos); 	// bitwise shift left by x positions, and invert
 	bit_array[index] = bit_array[index] & set; // binary and
 }
 
-int getBit(int *bit_array, int i) {
-	int index = i / sizeof(int);
-	int bit_pos = i % sizeof(int);
-	int set = 1;
+int getBit(uint64_t *bit_array, int i) {
+	int index = i / 64;
+	int bit_pos = i % 64;
+	uint64_t set = 1;
 	set = set << bit_pos;
 
     return ((bit_array[index] & set) != 0) ;
 }
 
-// returns the index of the next free block
-int get_next_free_block(int *bit_array) {
-	for (int i = 0; i < NUM_BLOCKS; i++)
-		if (getBit(bit_array, i) == 1)
-			return i;
+// returns the index of the first set bit, checking 64 bits at a time
+int get_next_free_block(uint64_t *bit_array) {
+	for (int w = 0; w < fbm_words; w++)
+		if (bit_array[w] != 0)
+			return w * 64 + __builtin_ctzll(bit_array[w]);
+	return -1;
+}
+
+/* 
+ * Block allocator over the FBM. fbm_free keeps the number of free blocks
+ * so fullness checks don't scan the map, and allocation resumes at the word
+ * where the last one stopped (next-fit) instead of rescanning from block 0.
+ */
+void fbm_count_free() {
+	pthread_mutex_lock(&alloc_lock);
+	fbm_free = 0;
+	for (int w = 0; w < fbm_words; w++)
+		fbm_free += __builtin_popcountll(FBM[w]);
+	fbm_cursor = 0;
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+// returns the first free block at or after the given one, wrapping around, or -1
+static int next_free_from(int block) {
+	int nwords = fbm_words;
+	int w = block / 64;
+	uint64_t word = FBM[w] & (~(uint64_t)0 << (block % 64)); // ignore bits before block
+
+	for (int n = 0; n <= nwords; n++) {
+		if (word != 0) {
+			STAT_ADD(alloc_words, n + 1);
+			return w * 64 + __builtin_ctzll(word);
+		}
+		w = (w + 1) % nwords;
+		word = FBM[w];
+	}
+	return -1;
+}
+
+// returns how many free blocks follow (and include) the given one, up to max
+static int free_run_length(int block, int max) {
+	int len = 0;
+	while (len < max && block + len < num_blocks) {
+		int b = block + len;
+		int avail = 64 - b % 64;	// bits left in this word
+		uint64_t word = FBM[b / 64] >> (b % 64);
+		int run = ~word == 0 ? 64 : __builtin_ctzll(~word);
+		if (run > avail)
+			run = avail;
+		len += run;
+		if (run < avail)
+			break;
+	}
+	return len < max ? len : max;
+}
+
+/* 
+ * reserves a run of up to `want` contiguous blocks, as close after `goal`
+ * as possible (goal = -1 means no preference: continue from the cursor).
+ * takes the first run at or after goal that is long enough, or failing
+ * that the first free block after goal and whatever follows it.
+ * returns the first block and stores the run length in *got, or -1 if full.
+ */
+int alloc_extent(int goal, int want, int *got) {
+	STAT_ADD(allocs, 1);
+	pthread_mutex_lock(&alloc_lock);
+	if (fbm_free == 0) {
+		pthread_mutex_unlock(&alloc_lock);
+		return -1;
+	}
+	if (goal < 0 || goal >= num_blocks)
+		goal = fbm_cursor * 64;
+
+	int first = next_free_from(goal);
+	int block = first;
+	int len = free_run_length(block, want);
+
+	// look for a run that holds the whole request, going once around the disk
+	while (len < want) {
+		int next = next_free_from((block + len) % num_blocks);
+		if ((next - first + num_blocks) % num_blocks <= (block - first + num_blocks) % num_blocks)
+			break;
+		block = next;
+		len = free_run_length(block, want);
+	}
+	if (len < want) {
+		block = first;
+		len = free_run_length(block, want);
+	}
+
+	for (int i = block; i < block + len; i++)
+		clrBit(FBM, i);
+	fbm_free -= len;
+	fbm_cursor = (block + len) % num_blocks / 64;
+	// a long run can cover whole FBM blocks between its first and last bit
+	for (int i = block / (block_size * 8); i <= (block + len - 1) / (block_size * 8); i++)
+		fbm_dirty[i] = 1;
+	pthread_mutex_unlock(&alloc_lock);
+	*got = len;
+	return block;
+}
+
+// returns a newly reserved block, or -1 if the disk is full
+int alloc_block() {
+	int got;
+	return alloc_extent(-1, 1, &got);
+}
+
+/* 
+ * Block map of a file: the first NUM_DIRECT_BLOCKS logical blocks are in
+ * inode->direct, the next ptrs_per_block are listed in the indirect block,
+ * and the rest go through the double-indirect block, whose entries point to
+ * indirect blocks. Map blocks are metadata: they go through the journal
+ * like the dir and FBM. Each open fd caches the last map blocks it used so
+ * sequential I/O looks up one pointer per block without touching the cache.
+ */
+void read_meta_block(int block, void *buf) {
+	lock_meta();
+	if (!use_journal || !journal_lookup(block, buf))
+		cache_read(block, 1, buf);
+	unlock_meta();
+}
+
+void write_meta_block(int block, void *buf) {
+	lock_meta();
+	if (use_journal)
+		journal_log(block, buf);
+	else
+		cache_write(block, 1, buf);
+	unlock_meta();
+}
+
+// returns the pointers in map block `block`, loading it into the fd's map cache
+static int *get_map(int fileID, int block) {
+	map_cache_t *maps = ofdt->entries[fileID].maps;
+	int i;
+	for (i = 0; i < MAP_CACHE_SLOTS - 1; i++)
+		if (maps[i].block == block)
+			break;
+
+	// miss: reuse the least recently used slot (the last one)
+	if (maps[i].block != block) {
+		if (maps[i].ptrs == NULL)
+			maps[i].ptrs = (int*)malloc(block_size);
+		read_meta_block(block, maps[i].ptrs);
+		maps[i].block = block;
+	}
+
+	map_cache_t hit = maps[i];
+	memmove(&maps[1], &maps[0], i * sizeof(map_cache_t));
+	maps[0] = hit;
+	return hit.ptrs;
+}
+
+// sets one pointer of a map block, keeping every fd caching that block in step
+static void set_map_ptr(int fileID, int block, int index, int value) {
+	int *ptrs = get_map(fileID, block);
+	ptrs[index] = value;
+	write_meta_block(block, ptrs);
+
+	// fds on the same file are idle: the caller holds the inode for writing
+	for (int i = 0; i < MAX_OPEN_FILES; i++) {
+		if (i == fileID || __atomic_load_n(&ofdt->entries[i].inode_no, __ATOMIC_ACQUIRE) != ofdt->entries[fileID].inode_no)
+			continue;
+		for (int j = 0; j < MAP_CACHE_SLOTS; j++)
+			if (ofdt->entries[i].maps[j].block == block)
+				ofdt->entries[i].maps[j].ptrs[index] = value;
+	}
+}
+
+/* 
+ * returns a new map block placed near goal, or -1 if full. it starts with
+ * the pointers of map block old, which it replaces (copy-on-write of a
+ * frozen block), or with every pointer unset if old is -1.
+ */
+static int new_map_block(int fileID, int old, int goal) {
+	int got;
+	int block = alloc_extent(goal, 1, &got);
+	if (block == -1)
+		return -1;
+
+	int *ptrs = (int*)malloc(block_size);
+	if (old != -1) {
+		memcpy(ptrs, get_map(fileID, old), block_size);
+		free_block(old);
+	} else {
+		for (int i = 0; i < ptrs_per_block; i++)
+			ptrs[i] = -1;
+	}
+	write_meta_block(block, ptrs);
+	free(ptrs);
+	return block;
+}
+
+static void drop_maps(int fileID) {
+	for (int i = 0; i < MAP_CACHE_SLOTS; i++) {
+		free(ofdt->entries[fileID].maps[i].ptrs);
+		ofdt->entries[fileID].maps[i].ptrs = NULL;
+		ofdt->entries[fileID].maps[i].block = -1;
+	}
+}
+
+// returns the disk block holding logical block lblk of the file, or -1 if none
+static int bmap(int fileID, int lblk) {
+	inode_t *inode = &dir->files[ofdt->entries[fileID].inode_no];
+	if (lblk < NUM_DIRECT_BLOCKS)
+		return inode->direct[lblk];
+
+	lblk -= NUM_DIRECT_BLOCKS;
+	if (lblk < ptrs_per_block)
+		return inode->indirect == -1 ? -1 : get_map(fileID, inode->indirect)[lblk];
+
+	lblk -= ptrs_per_block;
+	if (inode->double_indirect == -1)
+		return -1;
+	int leaf = get_map(fileID, inode->double_indirect)[lblk / ptrs_per_block];
+	return leaf == -1 ? -1 : get_map(fileID, leaf)[lblk % ptrs_per_block];
+}
+
+/* 
+ * points logical block lblk of the file to disk block phys, allocating
+ * the map blocks on the way if needed (right after phys when possible)
+ * and copying the ones a snapshot has frozen.
+ * returns 0 on success, -1 if the disk is full.
+ */
+static int bmap_set(int fileID, int lblk, int phys) {
+	int ino = ofdt->entries[fileID].inode_no;
+	inode_t *inode = &dir->files[ino];
+	int block;
+	if (lblk < NUM_DIRECT_BLOCKS) {
+		inode->direct[lblk] = phys;
+		mark_inode_dirty(ino);
+		return 0;
+	}
+
+	lblk -= NUM_DIRECT_BLOCKS;
+	if (lblk < ptrs_per_block) {
+		if (inode->indirect == -1 || frozen(inode->indirect)) {
+			if ((block = new_map_block(fileID, inode->indirect, phys + 1)) == -1)
+				return -1;
+			inode->indirect = block;
+			mark_inode_dirty(ino);
+		}
+		set_map_ptr(fileID, inode->indirect, lblk, phys);
+		return 0;
+	}
+
+	lblk -= ptrs_per_block;
+	if (inode->double_indirect == -1 || frozen(inode->double_indirect)) {
+		if ((block = new_map_block(fileID, inode->double_indirect, phys + 1)) == -1)
+			return -1;
+		inode->double_indirect = block;
+		mark_inode_dirty(ino);
+	}
+	int leaf = get_map(fileID, inode->double_indirect)[lblk / ptrs_per_block];
+	if (leaf == -1 || frozen(leaf)) {
+		if ((leaf = new_map_block(fileID, leaf, phys + 1)) == -1)
+			return -1;
+		set_map_ptr(fileID, inode->double_indirect, lblk / ptrs_per_block, leaf);
+	}
+	set_map_ptr(fileID, leaf, lblk % ptrs_per_block, phys);
+	return 0;
+}
+
+// number of map blocks that must be allocated (or copied from a snapshot) to address blocks [first, last]
+static int map_blocks_needed(inode_t *inode, int first, int last) {
+	int needed = 0;
+	if (last >= NUM_DIRECT_BLOCKS && first < NUM_DIRECT_BLOCKS + ptrs_per_block &&
+		(inode->indirect == -1 || frozen(inode->indirect)))
+		needed++;
+
+	if (last < NUM_DIRECT_BLOCKS + ptrs_per_block)
+		return needed;
+
+	int base = NUM_DIRECT_BLOCKS + ptrs_per_block;
+	int lo = (first > base ? first - base : 0) / ptrs_per_block;
+	int hi = (last - base) / ptrs_per_block;
+	if (inode->double_indirect == -1)
+		return needed + 1 + hi - lo + 1;
+	if (frozen(inode->double_indirect))
+		needed++;
+
+	int *top = (int*)malloc(block_size);
+	read_meta_block(inode->double_indirect, top);
+	for (int i = lo; i <= hi; i++)
+		if (top[i] == -1 || frozen(top[i]))
+			needed++;
+	free(top);
+	return needed;
+}
+
+/* 
+ * gives data blocks to every unallocated pointer in [first, last],
+ * each missing run as an extent placed right after the file's previous block.
+ * only the pointer updates hold meta_lock, so files grow in parallel.
+ * returns 0 on success, -1 if the disk is full.
+ */
+static int allocate_file_blocks(int fileID, int first, int last) {
+	for (int i = first; i <= last; ) {
+		if (bmap(fileID, i) != -1) {
+			i++;
+			continue;
+		}
+
+		int want = 1;
+		while (i + want <= last && bmap(fileID, i + want) == -1)
+			want++;
+
+		int prev = i > 0 ? bmap(fileID, i - 1) : -1;
+		int goal = prev != -1 ? prev + 1 : -1;
+		int got;
+		int block = alloc_extent(goal, want, &got);
+		if (block == -1)
+			return -1;
+
+		lock_meta();
+		int ret = 0;
+		for (int j = 0; j < got && ret == 0; j++)
+			ret = bmap_set(fileID, i + j, block + j);
+		unlock_meta();
+		if (ret != 0)
+			return -1;
+		i += got;
+	}
+	return 0;
+}
+
+// number of blocks from i (up to last, at most MAX_IO_BLOCKS) that sit next to each other on disk
+static int contiguous_run(int fileID, int i, int last) {
+	int first = bmap(fileID, i);
+	int n = 1;
+	while (n < MAX_IO_BLOCKS && i + n <= last && bmap(fileID, i + n) == first + n)
+		n++;
+	return n;
+}
+
+/*
+ * a block is frozen while a snapshot may still hold it: its WM bit is 0.
+ * read without alloc_lock: blocks are only frozen under the exclusive
+ * commit_lock, so a caller holding it shared can only see a block thaw,
+ * and a stale "frozen" costs no more than a needless copy-on-write.
+ */
+static int frozen(int block) {
+	uint64_t wm = __atomic_load_n(&WM[block / 64], __ATOMIC_RELAXED);
+	return !(wm & ((uint64_t)1 << (block % 64)));
+}
+
+// blocks frozen by a snapshot stay reserved; sweep_frozen() frees them once no snapshot holds them
+void free_block(int block) {
+	pthread_mutex_lock(&alloc_lock);
+	if (!getBit(FBM, block) && getBit(WM, block)) {
+		setBit(FBM, block);
+		fbm_free++;
+		mark_fbm_dirty(block);
+	}
+	pthread_mutex_unlock(&alloc_lock);
+}
+
+/* 
+ * In-memory hash index over the directory entries, so that finding a file
+ * by name does not scan every entry. Every directory's entries share it:
+ * the key is the directory's inode and the name. Built by the first lookup
+ * after a mount from the inodes the IBM marks used, reading in only the
+ * entry blocks that hold them, so it costs the files on the volume rather
+ * than its inode table; kept up to date on create/remove. Slots hold inode
+ * numbers; the key is compared against dir_entries[ino].
+ */
+static unsigned int hash_name(int parent, char *name) {
+	return fnv1a(fnv1a(FNV_SEED, &parent, sizeof(parent)), name, strlen(name));
+}
+
+// returns the inode number of the entry named name in directory parent, or -1
+int name_index_find(int parent, char *name) {
+	if (__atomic_load_n(&name_index, __ATOMIC_ACQUIRE) == NULL) {
+		// lookups may run side by side under a shared dir_lock: one of them builds it
+		lock_meta();
+		if (name_index == NULL)
+			name_index_build();
+		unlock_meta();
+	}
+	for (int h = hash_name(parent, name) & name_index_mask; name_index[h] != -1; h = (h + 1) & name_index_mask) {
+		dir_entry_t *entry = &dir_entries[name_index[h]];
+		if (entry->parent == parent && strcmp(entry->filename, name) == 0)
+			return name_index[h];
+	}
 	return -1;
 }
 
+// puts ino in its slot of index, which has room
+static void index_place(int *index, int mask, int ino) {
+	int h = hash_name(dir_entries[ino].parent, dir_entries[ino].filename) & mask;
+	while (index[h] != -1)
+		h = (h + 1) & mask;
+	index[h] = ino;
+}
+
+// an empty index with room for count entries at most half full
+static int *index_alloc(int count) {
+	int size = 64;
+	while (size < 2 * count)
+		size <<= 1;
+	int *index = (int*)malloc(size * sizeof(int));
+	for (int i = 0; i < size; i++)
+		index[i] = -1;
+	name_index_mask = size - 1;
+	return index;
+}
+
+// called with dir_lock held for writing, so no lookup sees the index move
+void name_index_insert(int ino) {
+	if (2 * (name_index_count + 1) > name_index_mask + 1) {
+		int *old = name_index;
+		int old_size = name_index_mask + 1;
+		name_index = index_alloc(name_index_count + 1);
+		for (int i = 0; i < old_size; i++)
+			if (old[i] != -1)
+				index_place(name_index, name_index_mask, old[i]);
+		free(old);
+	}
+	index_place(name_index, name_index_mask, ino);
+	name_index_count++;
+}
+
+// must be called before the entry's filename is cleared
+void name_index_remove(int ino) {
+	int h = hash_name(dir_entries[ino].parent, dir_entries[ino].filename) & name_index_mask;
+	while (name_index[h] != ino)
+		h = (h + 1) & name_index_mask;
+	name_index[h] = -1;
+	name_index_count--;
+
+	// re-place the rest of the cluster so later lookups do not stop at the hole
+	for (int i = (h + 1) & name_index_mask; name_index[i] != -1; i = (i + 1) & name_index_mask) {
+		int moved = name_index[i];
+		name_index[i] = -1;
+		index_place(name_index, name_index_mask, moved);
+	}
+}
+
+// true if inode ino has an entry: used in the IBM, named
+static int entry_used(int ino) {
+	return ino < max_inodes && !getBit(IBM, ino) && dir_entries[ino].inode_no != -1 && dir_entries[ino].filename[0] != '\0';
+}
+
+// the IBM must be up to date; reads in the entry blocks of the used inodes
+void name_index_build() {
+	int count = 0;
+	for (int w = 0; w < ibm_words; w++)
+		count += 64 - __builtin_popcountll(IBM[w]);
+
+	free(name_index);
+	__atomic_store_n(&name_index, NULL, __ATOMIC_RELAXED);
+	int *index = index_alloc(count);
+
+	name_index_count = 0;
+	for (int w = 0; w < ibm_words; w++) {
+		if (IBM[w] == ~(uint64_t)0)
+			continue;
+		int n = max_inodes - w * 64 < 64 ? max_inodes - w * 64 : 64;
+		load_dir(&dir_entries[w * 64], n * sizeof(dir_entry_t));
+		for (int i = w * 64; i < w * 64 + n; i++) {
+			if (!entry_used(i))
+				continue;
+			index_place(index, name_index_mask, i);
+			name_index_count++;
+		}
+	}
+	// lookups that do not take meta_lock use it as soon as they see it
+	__atomic_store_n(&name_index, index, __ATOMIC_RELEASE);
+}
+
+/* 
+ * Paths. A path names its directories from the top level down, separated
+ * by '/' ("dir/sub/name"; a leading '/' is allowed); each name is 1 to
+ * SSFS_MAX_NAME bytes. Every component is one name_index lookup, and the
+ * directories a path leads to are remembered in path_cache, keyed by the
+ * path up to the last '/', so the files of one directory resolve with a
+ * single lookup. Slots are only trusted while path_cache_gen has not moved
+ * on: it does when a directory is removed, the dir is restored or a
+ * volume is mounted.
+ */
+static unsigned int hash_path(char *path, int len) {
+	return fnv1a(FNV_SEED, path, len);
+}
+
+// copies the len bytes of a path component to name; returns 0, or -1 if it is not a valid name
+static int copy_name(char *name, char *component, int len) {
+	if (len < 1 || len > SSFS_MAX_NAME)
+		return -1;
+	memcpy(name, component, len);
+	name[len] = '\0';
+	return 0;
+}
+
+// forgets every cached path
+static void path_cache_clear() {
+	pthread_mutex_lock(&path_cache_lock);
+	path_cache_gen++;
+	pthread_mutex_unlock(&path_cache_lock);
+}
+
+/* 
+ * finds the directory holding the last component of path (its inode, or
+ * ROOT_DIR) and copies that component to name, which holds SSFS_MAX_NAME + 1
+ * bytes. every directory on the way must exist. call with dir_lock held.
+ * returns 0 on success, -1 on error.
+ */
+static int resolve_parent(char *path, int *parent, char *name) {
+	char *start = *path == '/' ? path + 1 : path;
+	char *last = strrchr(start, '/');
+	char *leaf = last == NULL ? start : last + 1;
+	int len = last == NULL ? 0 : last - start;	// of the directory part
+
+	if (copy_name(name, leaf, strlen(leaf)) != 0) {
+		fprintf(stderr, "Error: Bad name in path '%s' (1 to %d bytes between '/')\n", path, SSFS_MAX_NAME);
+		return -1;
+	}
+	if (last == NULL) {
+		*parent = ROOT_DIR;
+		return 0;
+	}
+
+	path_cache_t *slot = &path_cache[hash_path(start, len) & (PATH_CACHE_SLOTS - 1)];
+	pthread_mutex_lock(&path_cache_lock);
+	if (slot->path != NULL && slot->gen == path_cache_gen &&
+		strncmp(slot->path, start, len) == 0 && slot->path[len] == '\0') {
+		*parent = slot->ino;
+		pthread_mutex_unlock(&path_cache_lock);
+		STAT_ADD(path_hits, 1);
+		return 0;
+	}
+	pthread_mutex_unlock(&path_cache_lock);
+	STAT_ADD(path_misses, 1);
+
+	// walk it one directory at a time
+	char component[SSFS_MAX_NAME + 1];
+	int ino = ROOT_DIR;
+	for (char *c = start; c <= last; ) {
+		char *end = memchr(c, '/', last + 1 - c);
+		if (copy_name(component, c, end - c) != 0) {
+			fprintf(stderr, "Error: Bad name in path '%s' (1 to %d bytes between '/')\n", path, SSFS_MAX_NAME);
+			return -1;
+		}
+		ino = name_index_find(ino, component);
+		if (ino == -1 || !dir_entries[ino].is_dir) {
+			fprintf(stderr, "Error: No directory '%.*s'\n", (int)(end - start), start);
+			return -1;
+		}
+		c = end + 1;
+	}
+
+	pthread_mutex_lock(&path_cache_lock);
+	free(slot->path);
+	slot->path = strndup(start, len);
+	slot->ino = ino;
+	slot->gen = path_cache_gen;
+	pthread_mutex_unlock(&path_cache_lock);
+	*parent = ino;
+	return 0;
+}
+
 // returns the index of the next free file descriptor
 int get_next_free_fd() {
 	for (int i = 0; i < MAX_OPEN_FILES; i++)
-		if (ofdt->entries[i].inode_no == -1)
+		if (__atomic_load_n(&ofdt->entries[i].inode_no, __ATOMIC_ACQUIRE) == -1)
 			return i;
 	return -1;
 }
 
-// returns the index of the next free inode position (both file and entry)
+// returns the lowest free inode (both file and entry), or -1 if there is none
 int get_next_free_dir() {
-	for (int i = 0; i < MAX_INODES; i++)
-		if (dir->files[i].size == -1)
-			return i;
+	for (int w = ibm_cursor; w < ibm_words; w++) {
+		if (IBM[w] != 0) {
+			ibm_cursor = w;
+			return w * 64 + __builtin_ctzll(IBM[w]);
+		}
+	}
+	ibm_cursor = ibm_words;
 	return -1;
 }
 
+// marks inode ino used (used = 1) or free in the IBM
+static void set_inode_used(int ino, int used) {
+	if (used) {
+		clrBit(IBM, ino);
+	} else {
+		setBit(IBM, ino);
+		if (ino / 64 < ibm_cursor)
+			ibm_cursor = ino / 64;
+	}
+	mark_ibm_dirty(ino);
+}
+
+// copies the part of the record at dir offset at that falls in [lo, hi)
+static void copy_clipped(char *base, long at, void *record, int len, long lo, long hi) {
+	long from = at > lo ? at : lo;
+	long to = at + len < hi ? at + len : hi;
+	if (from < to)
+		memcpy(base + from, (char*)record + (from - at), to - from);
+}
+
+/* 
+ * fills block i of a dir (the cached one, or a snapshot's) with empty inodes
+ * and entries: what a dir block holds before it gets a disk block.
+ */
+static void init_dir_block(char *base, int i) {
+	long lo = (long)i * block_size, hi = lo + block_size;
+	long files = (char*)dir->files - (char*)dir;
+	long entries = (char*)dir_entries - (char*)dir;
+	inode_t empty_inode;
+	dir_entry_t empty_entry;
+
+	memset(&empty_inode, 0xff, sizeof(inode_t));	// size and every pointer -1
+	memset(&empty_entry, 0, sizeof(dir_entry_t));
+	empty_entry.inode_no = -1;
+
+	memset(base + lo, 0, block_size);
+	if (i == 0)
+		((directory_t*)base)->size = dir_blocks * block_size;
+	for (long k = lo > files ? (lo - files) / sizeof(inode_t) : 0; k < max_inodes && files + k * (long)sizeof(inode_t) < hi; k++)
+		copy_clipped(base, files + k * sizeof(inode_t), &empty_inode, sizeof(inode_t), lo, hi);
+	for (long k = lo > entries ? (lo - entries) / sizeof(dir_entry_t) : 0; k < max_inodes && entries + k * (long)sizeof(dir_entry_t) < hi; k++)
+		copy_clipped(base, entries + k * sizeof(dir_entry_t), &empty_entry, sizeof(dir_entry_t), lo, hi);
+}
+
+// the inode whose blocks are the dir's block i (the j-node, or dir.blks), and i's place among them
+static inode_t *dir_block_map(int i, int *lblk) {
+	if (i < files_blocks) {
+		*lblk = i;
+		return &superblock->root;
+	}
+	*lblk = i - files_blocks;
+	return &dir->files[1];
+}
+
+// returns the disk block of dir block i, or -1 if it has none yet. call with meta_lock held
+static int dir_block_phys(int i) {
+	if (dir_phys[i] == 0) {
+		int lblk;
+		inode_t *map = dir_block_map(i, &lblk);
+		dir_phys[i] = snap_map_get(map, lblk);
+	}
+	return dir_phys[i];
+}
+
+/* 
+ * reads in the blocks of the cached dir under [ptr, ptr + len) that are not
+ * in yet. Mount only reads the dir header, so mounting takes the same time
+ * however many inodes there are; a block is read the first time an inode or
+ * entry in it is used, and stays in until the next mount. Blocks with an open
+ * file's inode are always in. A block with no disk block is all empty.
+ */
+static void load_dir(void *ptr, int len) {
+	int first = ((char*)ptr - (char*)dir) / block_size;
+	int last = ((char*)ptr - (char*)dir + len - 1) / block_size;
+	int i = first;
+	while (i <= last && __atomic_load_n(&dir_loaded[i], __ATOMIC_ACQUIRE))
+		i++;
+	if (i > last)
+		return;
+
+	lock_meta();
+	while (i <= last) {
+		if (dir_loaded[i]) {
+			i++;
+			continue;
+		}
+
+		// read each run of missing blocks that are next to each other on disk with one call
+		int phys = dir_block_phys(i);
+		int run = 1;
+		if (phys == -1) {
+			init_dir_block((char*)dir, i);
+		} else {
+			while (i + run <= last && !dir_loaded[i + run] && dir_block_phys(i + run) == phys + run)
+				run++;
+			cache_read(phys, run, (char*)dir + (size_t)i * block_size);
+		}
+		for (int j = i; j < i + run; j++)
+			__atomic_store_n(&dir_loaded[j], 1, __ATOMIC_RELEASE);
+		i += run;
+	}
+	unlock_meta();
+}
+
+// returns inode ino in the cached dir, reading its block in if needed
+static inode_t *get_inode(int ino) {
+	load_dir(&dir->files[ino], sizeof(inode_t));
+	return &dir->files[ino];
+}
+
+/* 
+ * gives each dir block under [ptr, ptr + len) a disk block from the data
+ * area if it has none yet, next to the dir block before it when possible.
+ * call before using an inode or entry for the first time.
+ * returns 0 on success, -1 if the disk is full.
+ */
+static int map_dir_blocks(void *ptr, int len) {
+	int first = ((char*)ptr - (char*)dir) / block_size;
+	int last = ((char*)ptr - (char*)dir + len - 1) / block_size;
+	int ret = 0;
+
+	load_dir(ptr, len);
+	lock_meta();
+	for (int i = first; i <= last && ret == 0; i++) {
+		if (dir_block_phys(i) != -1)
+			continue;
+
+		int lblk, got;
+		inode_t *map = dir_block_map(i, &lblk);
+		int prev = i > 0 ? dir_block_phys(i - 1) : -1;
+		int phys = alloc_extent(prev != -1 ? prev + 1 : data_start, 1, &got);
+		if (phys == -1 || snap_map_set(map, lblk, phys) != 0) {
+			if (phys != -1)
+				free_block(phys);
+			ret = -1;
+			break;
+		}
+		dir_phys[i] = phys;
+
+		// root.blks is a copy of the j-node
+		if (map == &superblock->root) {
+			dir->files[0] = superblock->root;
+			write_superblock();
+			map = &dir->files[0];
+		}
+		mark_dir_dirty(map, sizeof(inode_t));
+		mark_dir_dirty((char*)dir + (size_t)i * block_size, block_size);
+	}
+	unlock_meta();
+	return ret;
+}
+
 /* 
- * Dir, FBM, and WM are cached for easy and quick access.
- * Should be written to disk after changes.
+ * Dir, FBM, WM and IBM are cached for easy and quick access.
+ * Should be written to disk after changes (the dir: its blocks flagged dirty).
  */
 void write_dir_to_disk() {
-	char *buf = (char*)calloc(1, dir->size + 1);
-	buf[dir->size] = '\0';
-	memcpy(buf, dir, dir->size);
-	write_blocks(1, dir->size / BLOCK_SIZE, buf); // dir starts after super block (1 onwards)
-	free(buf);
+	for (int k = 0; k < dir_dirty_count; k++) {
+		int i = dir_dirty_list[k];
+		cache_write(dir_block_phys(i), 1, (char*)dir + (size_t)i * block_size);
+		dir_dirty[i] = 0;
+	}
+	dir_dirty_count = 0;
 }
 
 void write_fbm_to_disk() {
-	char *buf = (char*)calloc(1, BLOCK_SIZE_NULL_T);
-	buf[BLOCK_SIZE] = '\0';
-	memcpy(buf, FBM, BLOCK_SIZE);
-	write_blocks(NUM_BLOCKS-2, 1, buf);
-	free(buf);
+	cache_write(fbm_start, fbm_blocks, FBM);
+	memset(fbm_dirty, 0, fbm_blocks);
 }
 
 void write_wm_to_disk() {
-	char *buf = (char*)calloc(1, BLOCK_SIZE_NULL_T);
-	buf[BLOCK_SIZE] = '\0';
-	memcpy(buf, WM, BLOCK_SIZE);
-	write_blocks(NUM_BLOCKS-1, 1, buf);
-	free(buf);
+	cache_write(wm_start, fbm_blocks, WM);
+	memset(wm_dirty, 0, fbm_blocks);
+}
+
+void write_ibm_to_disk() {
+	cache_write(ibm_start, ibm_blocks, IBM);
+	memset(ibm_dirty, 0, ibm_blocks);
+}
+
+/* 
+ * Incremental metadata writes: changes to the cached dir are flagged per
+ * block, and sync_metadata() hands only those blocks (plus the FBM and IBM
+ * blocks whose bits changed) to the journal. Every JOURNAL_GROUP_OPS
+ * operations the journal commits them all as one sequential write; without
+ * a journal they are written in place right away.
+ */
+void mark_dir_dirty(void *ptr, int len) {
+	int offset = (char*)ptr - (char*)dir;
+	for (int i = offset / block_size; i <= (offset + len - 1) / block_size; i++) {
+		if (!dir_dirty[i])
+			dir_dirty_list[dir_dirty_count++] = i;
+		dir_dirty[i] = dir_changed[i] = 1;
+	}
+}
+
+// an inode and its directory entry share the same index
+void mark_inode_dirty(int ino) {
+	mark_dir_dirty(&dir->files[ino], sizeof(inode_t));
+	mark_dir_dirty(&dir_entries[ino], sizeof(dir_entry_t));
+}
+
+// flags the FBM block holding the bit of the given disk block
+void mark_fbm_dirty(int block) {
+	fbm_dirty[block / (block_size * 8)] = 1;
+}
+
+// same for the WM
+void mark_wm_dirty(int block) {
+	wm_dirty[block / (block_size * 8)] = 1;
+}
+
+// same for the IBM and an inode
+void mark_ibm_dirty(int ino) {
+	ibm_dirty[ino / (block_size * 8)] = 1;
+}
+
+void sync_metadata() {
+	int written = 0;	// metadata blocks logged or written
+	lock_meta();
+	STAT_ADD(meta_syncs, 1);
+	for (int k = 0; k < dir_dirty_count; k++) {
+		int i = dir_dirty_list[k];
+		if (use_journal)
+			journal_log(dir_block_phys(i), (char*)dir + (size_t)i * block_size);
+		else
+			cache_write(dir_block_phys(i), 1, (char*)dir + (size_t)i * block_size);
+		dir_dirty[i] = 0;
+		written++;
+	}
+	dir_dirty_count = 0;
+	for (int i = 0; i < ibm_blocks; i++) {
+		if (!ibm_dirty[i])
+			continue;
+		if (use_journal)
+			journal_log(ibm_start + i, (char*)IBM + i * block_size);
+		else
+			cache_write(ibm_start + i, 1, (char*)IBM + i * block_size);
+		ibm_dirty[i] = 0;
+		written++;
+	}
+
+	if (use_journal) {
+		pthread_mutex_lock(&alloc_lock);
+		for (int i = 0; i < fbm_blocks; i++) {
+			if (!fbm_dirty[i])
+				continue;
+			journal_log(fbm_start + i, (char*)FBM + i * block_size);
+			fbm_dirty[i] = 0;
+			written++;
+		}
+		for (int i = 0; i < fbm_blocks; i++) {
+			if (!wm_dirty[i])
+				continue;
+			journal_log(wm_start + i, (char*)WM + i * block_size);
+			wm_dirty[i] = 0;
+			written++;
+		}
+		pthread_mutex_unlock(&alloc_lock);
+		STAT_ADD(meta_blocks, written);
+
+		if (++pending_ops >= JOURNAL_GROUP_OPS) {
+			journal_commit();
+			pending_ops = 0;
+		}
+		unlock_meta();
+		return;
+	}
+
+	pthread_mutex_lock(&alloc_lock);
+	for (int i = 0; i < fbm_blocks; i++) {
+		if (!fbm_dirty[i])
+			continue;
+		cache_write(fbm_start + i, 1, (char*)FBM + i * block_size);
+		fbm_dirty[i] = 0;
+		written++;
+	}
+	for (int i = 0; i < fbm_blocks; i++) {
+		if (!wm_dirty[i])
+			continue;
+		cache_write(wm_start + i, 1, (char*)WM + i * block_size);
+		wm_dirty[i] = 0;
+		written++;
+	}
+	pthread_mutex_unlock(&alloc_lock);
+	STAT_ADD(meta_blocks, written);
+	unlock_meta();
 }
 
 // return the amount of full blocks that correspond to the given size in bytes
@@ -667,12 +3222,12 @@ int bytes_to_blocks_rnd_up(int bytes) {
 	// size = 1111 bytes -> 2 blocks full
 	// size = 2048 bytes -> 2 blocks full
 
-	if (bytes % BLOCK_SIZE == 0) 	
-		return (int)((double)bytes / (double)BLOCK_SIZE);
+	if (bytes % block_size == 0) 	
+		return (int)((double)bytes / (double)block_size);
 	else 			
-		return (int)((double)bytes / (double)BLOCK_SIZE) + 1;
+		return (int)((double)bytes / (double)block_size) + 1;
 }
 
 int bytes_to_blocks_rnd_down(int bytes) {
-	return (int)((double)bytes / (double)BLOCK_SIZE);
+	return (int)((double)bytes / (double)block_size);
 }
\ No newline at end of file
@@ -1,23 +1,113 @@
+#include <stdint.h>
+#include <sys/uio.h>	// struct iovec
+
+// geometry of a volume; a fresh volume keeps it in its superblock
+typedef struct _ssfs_format_t {
+	char *image;		// disk image file
+	int block_size;		// in bytes, a power of two
+	int num_blocks;
+	int num_inodes;		// most files the volume can hold; their blocks are allocated as they are created
+} ssfs_format_t;
+
+// how the image is opened, see ssfs_set_backend
+#define SSFS_BACKEND_PIO	0	// pread/pwrite on the image file
+#define SSFS_BACKEND_MMAP	1	// the whole image mapped into memory
+
+// bytes in a file or directory name, without the '\0'; paths join names with '/'
+#define SSFS_MAX_NAME 21
+
+// calls timed into buckets: bucket i counts the ones that took [2^i, 2^(i+1)) ns
+#define SSFS_LATENCY_BUCKETS 40
+typedef struct _ssfs_latency_t {
+	long calls;
+	long total_ns;
+	long buckets[SSFS_LATENCY_BUCKETS];
+} ssfs_latency_t;
+
+// counters since the program started or the last ssfs_reset_stats
+typedef struct _ssfs_stats_t {
+	long disk_reads;		// requests to the disk, and the blocks they moved
+	long disk_writes;
+	long blocks_read;
+	long blocks_written;
+	long bytes_read;		// by ssfs_fread/ssfs_fwrite and their vector, positional and async versions
+	long bytes_written;
+	long cache_hits;		// in blocks
+	long cache_misses;
+	long rmw_blocks;		// partial blocks read back to be rewritten
+	long meta_syncs;		// sync_metadata calls
+	long meta_blocks;		// dir, FBM and WM blocks they wrote or logged
+	long allocs;			// alloc_extent calls
+	long alloc_words;		// FBM words they scanned
+	long path_hits;			// paths whose directory came from the path cache
+	long path_misses;		// and the ones walked a directory at a time
+	ssfs_latency_t fopen;
+	ssfs_latency_t fread;
+	ssfs_latency_t fwrite;
+	ssfs_latency_t remove;
+} ssfs_stats_t;
+
+// handle of an asynchronous read or write
+typedef struct _ssfs_req_t ssfs_req_t;
+typedef void (*ssfs_callback_t)(ssfs_req_t *req, int result, void *arg);
+
 //Functions you should implement. 
 //Return -1 for error besides mkssfs
+//Safe to call from several threads at once, except mkssfs, mkssfs_format,
+//ssfs_set_backend and ssfs_set_cache_size; one fd is used by one call at a time
 void mkssfs(int fresh);
+int mkssfs_format(int fresh, ssfs_format_t *format);
 int ssfs_fopen(char *name);
 int ssfs_fclose(int fileID);
 int ssfs_frseek(int fileID, int loc);
 int ssfs_fwseek(int fileID, int loc);
 int ssfs_fwrite(int fileID, char *buf, int length);
 int ssfs_fread(int fileID, char *buf, int length);
+int ssfs_fwritev(int fileID, const struct iovec *iov, int iovcnt);
+int ssfs_freadv(int fileID, const struct iovec *iov, int iovcnt);
+int ssfs_pwrite(int fileID, char *buf, int length, int offset);
+int ssfs_pread(int fileID, char *buf, int length, int offset);
 int ssfs_remove(char *file);
+int ssfs_mkdir(char *path);
+int ssfs_rmdir(char *path);
 int ssfs_commit();
 int ssfs_restore(int cnum);
-int get_next_free_block(int *bit_array);
+int ssfs_flush();
+int ssfs_set_backend(int backend);
+int ssfs_set_cache_size(int nblocks);
+void ssfs_get_stats(ssfs_stats_t *stats);
+void ssfs_reset_stats();
+void ssfs_dump_stats();
+ssfs_req_t *ssfs_fread_async(int fileID, char *buf, int length, ssfs_callback_t done, void *arg);
+ssfs_req_t *ssfs_fwrite_async(int fileID, char *buf, int length, ssfs_callback_t done, void *arg);
+int ssfs_progress();
+int ssfs_poll(ssfs_req_t *req);
+int ssfs_wait(ssfs_req_t *req);
+int get_next_free_block(uint64_t *bit_array);
+void fbm_count_free();
+int alloc_block();
+int alloc_extent(int goal, int want, int *got);
+void free_block(int block);
 int get_next_free_fd();
 int get_next_free_dir();
 void write_dir_to_disk();
 void write_fbm_to_disk();
 void write_wm_to_disk();
+void write_ibm_to_disk();
+void mark_dir_dirty(void *ptr, int len);
+void mark_inode_dirty(int ino);
+void mark_fbm_dirty(int block);
+void mark_wm_dirty(int block);
+void mark_ibm_dirty(int ino);
+void sync_metadata();
+void read_meta_block(int block, void *buf);
+void write_meta_block(int block, void *buf);
+int name_index_find(int parent, char *name);
+void name_index_insert(int ino);
+void name_index_remove(int ino);
+void name_index_build();
 int bytes_to_blocks_rnd_up(int bytes);
 int bytes_to_blocks_rnd_down(int bytes);
-void setBit(int *bit_array, int i);
-void clrBit(int *bit_array, int i);
-int  getBit(int *bit_array, int i);
\ No newline at end of file
+void setBit(uint64_t *bit_array, int i);
+void clrBit(uint64_t *bit_array, int i);
+int  getBit(uint64_t *bit_array, int i);
\ No newline at end of file
@@ -0,0 +1,351 @@
+/* sfs_bench.c
+ *
+ * Microbenchmarks. Each workload times every call it makes and prints one
+ * line per (workload, I/O size):
+ *   workload io_size ops ops_per_s mb_per_s p50_us p99_us p999_us
+ * Lines starting with '#' are comments, so the output can be diffed or
+ * loaded as is to catch regressions.
+ *
+ *   seq_write, seq_read    one file, front to back
+ *   rand_write, rand_read  seek to a random I/O-size-aligned offset, then transfer
+ *   create, remove         churn of small files named by rand_name()
+ *   mount                  cold mkssfs_format(0) of a volume with MOUNT_FILES files
+ *   mount_open             the same, plus opening and closing one of the files
+ *   full_mount, full_open  mount and mount_open of a volume with FULL_FILES files:
+ *                          the name index is not kept on disk, so the first
+ *                          lookup after a mount rebuilds it from every entry
+ *   path_open              opening and closing files PATH_FILES deep in a tree
+ *                          of directories, after a mount
+ *   hdd_read, hdd_async    random reads over HDD_FILES files on the HDD model in
+ *                          virtual time, one at a time with ssfs_fread and
+ *                          HDD_DEPTH at once with ssfs_fread_async
+ * For the mount workloads the io_size column is the number of inodes of the
+ * volume: the times should not grow with it, though the full ones grow with
+ * the number of files. For path_open it is the depth
+ * of the files, which should not matter much either. The hdd workloads run
+ * whatever -m says, with the cache off; their times are device time, and an
+ * async read's latency is that of the batch it was issued in. hdd_async
+ * should beat hdd_read by what the disk scheduler saves in seeks.
+ *
+ * Usage: sfs_bench [-m none|ssd|hdd] [-n ops] [-s seed]
+ * -m puts the disk behind a device model (real time, so hdd is slow),
+ * -n is the number of random I/Os, files created and mounts per run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "tests.h"
+
+#define FILE_BYTES  (8 * 1024 * 1024)   /* size of the file the read/write workloads use */
+#define CHURN_FILES 64                  /* files alive at once during create/remove */
+#define MOUNT_FILES 100                 /* files on the volumes of the mount workloads */
+#define FULL_INODES 131072              /* inodes of the volume of the full_ workloads */
+#define FULL_FILES  100000              /* files on it */
+#define PATH_DIRS   10                  /* subdirectories of each directory in path_open */
+#define PATH_FILES  100                 /* files in each directory at the bottom */
+#define HDD_FILES   8                   /* files the hdd workloads read from */
+#define HDD_BYTES   (4 * 1024 * 1024)   /* size of each of them */
+#define HDD_DEPTH   32                  /* async reads issued at once */
+
+static int io_sizes[] = { 512, 4096, 65536 };
+static int mount_inodes[] = { 1024, 8192, 65536 };
+static int path_depths[] = { 1, 2, 3 };
+static int num_ops = 2000;
+
+static double *lat;     /* microseconds per op of the running workload */
+static int nlat;
+
+static double now_us(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b){
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(double q){
+  int i = (int)(q * nlat);
+  return lat[i < nlat ? i : nlat - 1];
+}
+
+//Prints the line of one workload from the latencies recorded since the last report;
+//bytes is what each op moved
+static void report(const char *workload, int io_size, int bytes, double seconds){
+  if(nlat == 0)
+    return;
+  qsort(lat, nlat, sizeof(double), cmp_double);
+  printf("%-10s %7d %7d %12.1f %9.2f %9.1f %9.1f %9.1f\n", workload, io_size, nlat,
+         nlat / seconds, (double)nlat * bytes / seconds / (1024 * 1024),
+         percentile(0.5), percentile(0.99), percentile(0.999));
+  fflush(stdout);
+  nlat = 0;
+}
+
+static void fail(const char *what){
+  fprintf(stderr, "ERROR: %s\n", what);
+  exit(1);
+}
+
+static void sequential(int fd, char *buf, int io_size, int write){
+  double start = now_us();
+  if(write)
+    ssfs_fwseek(fd, 0);
+  else
+    ssfs_frseek(fd, 0);
+  for(int off = 0; off < FILE_BYTES; off += io_size){
+    double t = now_us();
+    int n = write ? ssfs_fwrite(fd, buf, io_size) : ssfs_fread(fd, buf, io_size);
+    lat[nlat++] = now_us() - t;
+    if(n != io_size)
+      fail(write ? "seq_write" : "seq_read");
+  }
+  ssfs_flush();
+  report(write ? "seq_write" : "seq_read", io_size, io_size, (now_us() - start) / 1e6);
+}
+
+static void random_io(int fd, char *buf, int io_size, int write){
+  int slots = FILE_BYTES / io_size;
+  double start = now_us();
+  for(int i = 0; i < num_ops; i++){
+    int off = rand() % slots * io_size;
+    double t = now_us();
+    int n;
+    if(write)
+      n = ssfs_fwseek(fd, off) == 0 ? ssfs_fwrite(fd, buf, io_size) : -1;
+    else
+      n = ssfs_frseek(fd, off) == 0 ? ssfs_fread(fd, buf, io_size) : -1;
+    lat[nlat++] = now_us() - t;
+    if(n != io_size)
+      fail(write ? "rand_write" : "rand_read");
+  }
+  ssfs_flush();
+  report(write ? "rand_write" : "rand_read", io_size, io_size, (now_us() - start) / 1e6);
+}
+
+//Creates (open, write, close) and removes small files, CHURN_FILES at a time
+static void churn(){
+  char *names[CHURN_FILES];
+  double *remove_lat = malloc(num_ops * sizeof(double));
+  int nremove = 0;
+  double create_time = 0, remove_time = 0;
+
+  for(int done = 0; done < num_ops; ){
+    int batch = num_ops - done < CHURN_FILES ? num_ops - done : CHURN_FILES;
+    for(int i = 0; i < batch; i++){
+      char *text = rand_text(100);
+      names[i] = rand_name();
+      double t = now_us();
+      int fd = ssfs_fopen(names[i]);
+      if(fd < 0 || ssfs_fwrite(fd, text, 100) != 100 || ssfs_fclose(fd) != 0)
+        fail("create");
+      lat[nlat++] = now_us() - t;
+      create_time += lat[nlat - 1];
+      free(text);
+    }
+    for(int i = 0; i < batch; i++){
+      double t = now_us();
+      if(ssfs_remove(names[i]) != 0)
+        fail("remove");
+      remove_lat[nremove++] = now_us() - t;
+      remove_time += remove_lat[nremove - 1];
+      free(names[i]);
+    }
+    done += batch;
+  }
+  report("create", 100, 100, create_time / 1e6);
+
+  memcpy(lat, remove_lat, nremove * sizeof(double));
+  nlat = nremove;
+  report("remove", 0, 0, remove_time / 1e6);
+  free(remove_lat);
+}
+
+//Mounts a volume with num_inodes inodes and num_files files; every mount starts with an empty cache
+static void mount(int num_inodes, int num_files, const char *workload, const char *open_workload){
+  ssfs_format_t format = { "benchmount", 4096, 65536, num_inodes };
+  char name[16];
+
+  if(mkssfs_format(1, &format) != 0)
+    fail("format");
+  for(int i = 0; i < num_files; i++){
+    snprintf(name, sizeof(name), "m%d", i);
+    int fd = ssfs_fopen(name);
+    if(fd < 0 || ssfs_fclose(fd) != 0)
+      fail("create");
+  }
+
+  for(int open = 0; open < 2; open++){
+    double start = now_us();
+    for(int i = 0; i < num_ops / 10 + 1; i++){
+      snprintf(name, sizeof(name), "m%d", rand() % num_files);
+      double t = now_us();
+      if(mkssfs_format(0, &format) != 0)
+        fail("mount");
+      if(open){
+        int fd = ssfs_fopen(name);
+        if(fd < 0 || ssfs_fclose(fd) != 0)
+          fail("mount_open");
+      }
+      lat[nlat++] = now_us() - t;
+    }
+    report(open ? open_workload : workload, num_inodes, 0, (now_us() - start) / 1e6);
+  }
+}
+
+//Writes into path the name of file f under directory d of a tree depth levels deep
+static void tree_path(char *path, int size, int depth, int d, int f){
+  int len = 0;
+  for(int level = 0; level < depth; level++, d /= PATH_DIRS)
+    len += snprintf(path + len, size - len, "d%d/", d % PATH_DIRS);
+  snprintf(path + len, size - len, "f%d", f);
+}
+
+//Opens files at random in a tree of PATH_DIRS^depth directories, fresh from a mount
+static void path_open(int depth){
+  ssfs_format_t format = { "benchpaths", 4096, 65536, 131072 };
+  int dirs = 1;
+  char path[64];
+
+  if(mkssfs_format(1, &format) != 0)
+    fail("format");
+  for(int level = 1; level <= depth; level++){
+    dirs *= PATH_DIRS;
+    for(int d = 0; d < dirs; d++){
+      tree_path(path, sizeof(path), level, d, 0);
+      *strrchr(path, '/') = '\0';
+      if(ssfs_mkdir(path) != 0)
+        fail("mkdir");
+    }
+  }
+  for(int d = 0; d < dirs; d++)
+    for(int f = 0; f < PATH_FILES; f++){
+      tree_path(path, sizeof(path), depth, d, f);
+      int fd = ssfs_fopen(path);
+      if(fd < 0 || ssfs_fclose(fd) != 0)
+        fail("create");
+    }
+
+  if(mkssfs_format(0, &format) != 0)
+    fail("mount");
+  double start = now_us();
+  for(int i = 0; i < num_ops; i++){
+    tree_path(path, sizeof(path), depth, rand() % dirs, rand() % PATH_FILES);
+    double t = now_us();
+    int fd = ssfs_fopen(path);
+    if(fd < 0 || ssfs_fclose(fd) != 0)
+      fail("path_open");
+    lat[nlat++] = now_us() - t;
+  }
+  report("path_open", depth, 0, (now_us() - start) / 1e6);
+}
+
+//Random 4 KB reads over HDD_FILES files on the HDD model in virtual time, so the
+//elevator's seek savings show without waiting them out; the cache is off, and
+//the files fill most of the disk so the seeks span it
+static void hdd_reads(int async){
+  ssfs_format_t format = { "benchhdd", 4096, 9216, 64 };
+  disk_model_t hdd = disk_model_hdd;
+  ssfs_req_t *reqs[HDD_DEPTH];
+  int fds[HDD_FILES], slots = HDD_BYTES / 4096;
+  char name[16];
+
+  if(mkssfs_format(1, &format) != 0)
+    fail("format");
+  char *buf = malloc(HDD_DEPTH * 4096);
+  memset(buf, 'h', 4096);
+  for(int f = 0; f < HDD_FILES; f++){
+    snprintf(name, sizeof(name), "h%d", f);
+    if((fds[f] = ssfs_fopen(name)) < 0)
+      fail("fopen");
+    for(int off = 0; off < HDD_BYTES; off += 4096)
+      if(ssfs_fwrite(fds[f], buf, 4096) != 4096)
+        fail("fwrite");
+  }
+  ssfs_flush();
+  ssfs_set_cache_size(0);
+  hdd.virtual_time = 1;
+  disk_set_model(&hdd);
+
+  for(int i = 0; i < num_ops; ){
+    int batch = async && num_ops - i > HDD_DEPTH ? HDD_DEPTH : async ? num_ops - i : 1;
+    long long t = disk_model_clock();
+    for(int j = 0; j < batch; j++){
+      int fd = fds[rand() % HDD_FILES];
+      if(ssfs_frseek(fd, rand() % slots * 4096) != 0)
+        fail(async ? "hdd_async" : "hdd_read");
+      if(async)
+        reqs[j] = ssfs_fread_async(fd, buf + j * 4096, 4096, NULL, NULL);
+      else if(ssfs_fread(fd, buf, 4096) != 4096)
+        fail("hdd_read");
+    }
+    for(int j = 0; async && j < batch; j++)
+      if(reqs[j] == NULL || ssfs_wait(reqs[j]) != 4096)
+        fail("hdd_async");
+    for(int j = 0; j < batch; j++)
+      lat[nlat++] = disk_model_clock() - t;
+    i += batch;
+  }
+  report(async ? "hdd_async" : "hdd_read", 4096, 4096, disk_model_clock() / 1e6);
+
+  disk_set_model(NULL);
+  ssfs_set_cache_size(256);     //the default
+  for(int f = 0; f < HDD_FILES; f++)
+    ssfs_fclose(fds[f]);
+  free(buf);
+}
+
+int main(int argc, char **argv){
+  ssfs_format_t format = { "benchdisk", 4096, 4096, 512 };
+  int opt;
+
+  srand(1);
+  while((opt = getopt(argc, argv, "m:n:s:")) != -1){
+    if(opt == 'm' && strcmp(optarg, "ssd") == 0)
+      disk_set_model(&disk_model_ssd);
+    else if(opt == 'm' && strcmp(optarg, "hdd") == 0)
+      disk_set_model(&disk_model_hdd);
+    else if(opt == 'n' && atoi(optarg) > 0)
+      num_ops = atoi(optarg);
+    else if(opt == 's')
+      srand(atoi(optarg));
+    else if(!(opt == 'm' && strcmp(optarg, "none") == 0)){
+      fprintf(stderr, "usage: %s [-m none|ssd|hdd] [-n ops] [-s seed]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  lat = malloc((FILE_BYTES / io_sizes[0] + num_ops) * sizeof(double));
+  char *buf = rand_text(io_sizes[2]);
+
+  if(mkssfs_format(1, &format) != 0)
+    fail("format");
+  int fd = ssfs_fopen("bench.dat");
+  if(fd < 0)
+    fail("fopen");
+
+  printf("# workload io_size ops ops_per_s mb_per_s p50_us p99_us p999_us\n");
+  for(int i = 0; i < 3; i++){
+    sequential(fd, buf, io_sizes[i], 1);
+    sequential(fd, buf, io_sizes[i], 0);
+    random_io(fd, buf, io_sizes[i], 1);
+    random_io(fd, buf, io_sizes[i], 0);
+  }
+  ssfs_fclose(fd);
+  churn();
+  for(int i = 0; i < 3; i++)
+    mount(mount_inodes[i], MOUNT_FILES, "mount", "mount_open");
+  mount(FULL_INODES, FULL_FILES, "full_mount", "full_open");
+  for(int i = 0; i < 3; i++)
+    path_open(path_depths[i]);
+  hdd_reads(0);
+  hdd_reads(1);
+
+  free(buf);
+  free(lat);
+  return 0;
+}
@@ -0,0 +1,181 @@
+/* sfs_stress.c
+ *
+ * Multi-threaded stress test and scaling benchmark. For 1, 2, 4 and 8
+ * threads it runs:
+ *   - private: every thread writes its own file, then reads it back
+ *   - shared:  every thread reads one shared file at random offsets
+ *     through its own fd
+ * and checks every byte read. Reports ops/s and the speedup over one thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "sfs_api.h"
+
+#define MAX_THREADS   8
+#define CHUNK         4096              /* bytes per fwrite/fread */
+#define PRIVATE_BYTES (256 * 1024)      /* file written by each thread */
+#define SHARED_BYTES  (1024 * 1024)
+#define SHARED_READS  4000              /* per thread */
+
+static int errors = 0;
+static pthread_mutex_t errors_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+  int id;
+  int round;
+  int ops;
+} worker_t;
+
+//Byte expected at offset off of file number f
+static char pattern(int f, int off){
+  return (char)('A' + (f * 7 + off / 3 + off) % 26);
+}
+
+static void fail(const char *what, int id){
+  pthread_mutex_lock(&errors_lock);
+  errors++;
+  if(errors < 20)
+    fprintf(stderr, "ERROR: %s (thread %d)\n", what, id);
+  pthread_mutex_unlock(&errors_lock);
+}
+
+static double now(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Each thread creates its own file, writes it in chunks, then reads it back
+static void *private_worker(void *arg){
+  worker_t *w = arg;
+  char name[16];
+  char *buf = malloc(CHUNK);
+  int f = 1 + w->round * MAX_THREADS + w->id;
+
+  snprintf(name, sizeof(name), "p%d_%d", w->round, w->id);
+  int fd = ssfs_fopen(name);
+  if(fd < 0){
+    fail("fopen", w->id);
+    free(buf);
+    return NULL;
+  }
+
+  for(int off = 0; off < PRIVATE_BYTES; off += CHUNK){
+    for(int i = 0; i < CHUNK; i++)
+      buf[i] = pattern(f, off + i);
+    if(ssfs_fwrite(fd, buf, CHUNK) != CHUNK)
+      fail("fwrite", w->id);
+    w->ops++;
+  }
+
+  ssfs_frseek(fd, 0);
+  for(int off = 0; off < PRIVATE_BYTES; off += CHUNK){
+    if(ssfs_fread(fd, buf, CHUNK) != CHUNK){
+      fail("fread", w->id);
+      break;
+    }
+    for(int i = 0; i < CHUNK; i++)
+      if(buf[i] != pattern(f, off + i)){
+        fail("private file content", w->id);
+        break;
+      }
+    w->ops++;
+  }
+
+  ssfs_fclose(fd);
+  ssfs_remove(name);
+  free(buf);
+  return NULL;
+}
+
+//Each thread reads the shared file at random chunk-aligned offsets
+static void *shared_worker(void *arg){
+  worker_t *w = arg;
+  char *buf = malloc(CHUNK);
+  unsigned int seed = 12345 + w->id;
+
+  int fd = ssfs_fopen("shared");
+  if(fd < 0){
+    fail("fopen shared", w->id);
+    free(buf);
+    return NULL;
+  }
+
+  for(int n = 0; n < SHARED_READS; n++){
+    int off = rand_r(&seed) % (SHARED_BYTES / CHUNK) * CHUNK;
+    if(ssfs_frseek(fd, off) != 0 || ssfs_fread(fd, buf, CHUNK) != CHUNK){
+      fail("fread shared", w->id);
+      break;
+    }
+    for(int i = 0; i < CHUNK; i++)
+      if(buf[i] != pattern(0, off + i)){
+        fail("shared file content", w->id);
+        break;
+      }
+    w->ops++;
+  }
+
+  ssfs_fclose(fd);
+  free(buf);
+  return NULL;
+}
+
+//Runs nthreads copies of fn; returns ops/s
+static double run(void *(*fn)(void *), int nthreads, int round){
+  pthread_t threads[MAX_THREADS];
+  worker_t workers[MAX_THREADS];
+  int ops = 0;
+
+  double start = now();
+  for(int i = 0; i < nthreads; i++){
+    workers[i].id = i;
+    workers[i].round = round;
+    workers[i].ops = 0;
+    pthread_create(&threads[i], NULL, fn, &workers[i]);
+  }
+  for(int i = 0; i < nthreads; i++){
+    pthread_join(threads[i], NULL);
+    ops += workers[i].ops;
+  }
+  return ops / (now() - start);
+}
+
+int main(){
+  ssfs_format_t format = { "stressdisk", 1024, 16384, 200 };
+  int counts[] = { 1, 2, 4, 8 };
+  double base_private = 0, base_shared = 0;
+
+  if(mkssfs_format(1, &format) != 0){
+    fprintf(stderr, "ERROR: could not format the disk\n");
+    return 1;
+  }
+
+  //The shared file, written once
+  char *buf = malloc(CHUNK);
+  int fd = ssfs_fopen("shared");
+  for(int off = 0; off < SHARED_BYTES; off += CHUNK){
+    for(int i = 0; i < CHUNK; i++)
+      buf[i] = pattern(0, off + i);
+    ssfs_fwrite(fd, buf, CHUNK);
+  }
+  ssfs_fclose(fd);
+  free(buf);
+
+  printf("%-8s %-8s %12s %8s\n", "test", "threads", "ops/s", "speedup");
+  for(int c = 0; c < 4; c++){
+    double private_ops = run(private_worker, counts[c], c);
+    double shared_ops = run(shared_worker, counts[c], c);
+    if(c == 0){
+      base_private = private_ops;
+      base_shared = shared_ops;
+    }
+    printf("%-8s %-8d %12.0f %7.2fx\n", "private", counts[c], private_ops, private_ops / base_private);
+    printf("%-8s %-8d %12.0f %7.2fx\n", "shared", counts[c], shared_ops, shared_ops / base_shared);
+  }
+
+  printf("Current Error Num: %d\n", errors);
+  return errors == 0 ? 0 : 1;
+}
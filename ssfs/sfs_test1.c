@@ -60,11 +60,14 @@ int simple_test(){
   }
   free(file_id);
   free(file_names);
-  return 0;
+  return err_no;
 }
 
-/* The main testing program
+/* The main testing program: once on each backend
  */
 int main(int argc, char **argv){
-  simple_test();
+  int err_no = simple_test();
+  ssfs_set_backend(SSFS_BACKEND_PIO);
+  err_no += simple_test();
+  printf("\n-------------------------------\nBoth backends tested.\nCurrent Error Num: %d\n--------------------------------\n\n", err_no);
 }
\ No newline at end of file
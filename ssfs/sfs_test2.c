@@ -80,6 +80,27 @@ int difficult_test(){
   test_close_files(file_names, file_id, num_file, &err_no);
   test_remove_files(file_id, file_size, write_ptr, file_names, write_buf, num_file, &err_no);
   //So at this point, there should be no files live. 
+  //Volumes of their own for the rest
+  test_fbm_span(&err_no);
+  test_async(&err_no);
+  test_aio_order(&err_no);
+  test_async_batch(&err_no);
+  test_snapshots(&err_no);
+  test_disk_failure(&err_no);
+  test_stats(&err_no);
+  test_vector_io(&err_no);
+  test_directories(&err_no);
+  test_cache(&err_no);
+  test_meta_blocks(&err_no);
+  test_journal_replay(&err_no);
+  test_name_index(&err_no);
+  test_free_blocks(&err_no);
+  test_extents(&err_no);
+  test_read_ahead(&err_no);
+  test_full_blocks(&err_no);
+  test_sparse_format(&err_no);
+  test_superblock_check(&err_no);
+  test_inode_reuse(&err_no);
   //final round
   printf("\n-------------------------------\nDifficult test Finished.\nCurrent Error Num: %d\n--------------------------------\n\n", err_no);
   free_name_element(file_names, num_file);
@@ -91,11 +112,14 @@ int difficult_test(){
   free(write_ptr);
   free(file_id);
   free(file_names);
-  return 0;
+  return err_no;
 }
 
-/* The main testing program
+/* The main testing program: once on each backend
  */
 int main(int argc, char **argv){
-  difficult_test();
+  int err_no = difficult_test();
+  ssfs_set_backend(SSFS_BACKEND_PIO);
+  err_no += difficult_test();
+  printf("\n-------------------------------\nBoth backends tested.\nCurrent Error Num: %d\n--------------------------------\n\n", err_no);
 }
@@ -419,7 +419,7 @@ int test_write_to_overflow(int *file_id, int *file_size, char **write_buf, int i
     if(res < 0)
           fprintf(stderr, "Warning: ssfs_frseek returned negative. Potential frseek fail?\n");
     read_length = strlen(buffer[i]);
-    if(ssfs_fread(index, read_buffer, read_length) < 0){
+    if(ssfs_fread(file_id[index], read_buffer, read_length) < 0){
         fprintf(stderr, "Error: Read Failed. \n");
         *err_no += 1;
     }else if(read_length != strlen(read_buffer)){
@@ -710,3 +710,1165 @@ int free_name_element(char **name_list, int num_file){
     free(name_list[i]);
   return 0;
 }
+
+/*
+Writes a file long enough for one allocation to span several FBM blocks,
+remounts, then writes another file. If the FBM blocks in the middle of the
+run were not saved, the second file gets the first file's blocks.
+*/
+int test_fbm_span(int *err_no){
+  ssfs_format_t format = { "testfbm", 512, 16384, 64 };
+  int big = 4300 * 1024, small = 1024 * 1024;
+  char *data = rand_text(big);
+  char *other = rand_text(small);
+  char *read_buf = calloc(big, sizeof(char));
+
+  mkssfs_format(1, &format);
+  int fd = ssfs_fopen("a");
+  if(ssfs_fwrite(fd, data, big) != big){
+    fprintf(stderr, "Error: Could not write %d bytes to a\n", big);
+    *err_no += 1;
+  }
+  ssfs_fclose(fd);
+  ssfs_flush();
+
+  mkssfs_format(0, &format);
+  fd = ssfs_fopen("b");
+  if(ssfs_fwrite(fd, other, small) != small){
+    fprintf(stderr, "Error: Could not write %d bytes to b\n", small);
+    *err_no += 1;
+  }
+  ssfs_fclose(fd);
+
+  fd = ssfs_fopen("a");
+  if(ssfs_fread(fd, read_buf, big) != big || memcmp(read_buf, data, big) != 0){
+    fprintf(stderr, "Error: a changed after writing b on a remounted disk\n");
+    *err_no += 1;
+  }
+  ssfs_fclose(fd);
+
+  free(data);
+  free(other);
+  free(read_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+//Callback of the async requests below: keeps the result and counts calls
+static void async_done(ssfs_req_t *req, int result, void *arg){
+  int *state = arg;
+  state[0] = result;
+  state[1]++;
+}
+
+//Runs the callbacks until state has seen one, for at most about a second
+static int async_wait_callback(int *state){
+  for(int i = 0; i < 100000 && state[1] == 0; i++){
+    if(ssfs_progress() == 0)
+      usleep(10);
+  }
+  return state[1] == 1 ? state[0] : -1;
+}
+
+/*
+Round trips through the async calls: a write and a read collected with
+ssfs_poll/ssfs_wait, then a write and a read that report through a
+callback, then eight reads in flight at once on eight fds. Remounts at
+the end to check the written bytes reached the disk. Runs once on the
+worker threads, under a short real time model so they take the requests
+off a mapped image too, and once on io_uring where the kernel has it.
+*/
+int test_async(int *err_no){
+  ssfs_format_t format = { "testasync", 1024, 4096, 64 };
+  disk_model_t model = { DISK_LATENCY_FIXED, 100, 0, 0, 32 };
+  int engines[2] = { DISK_AIO_THREADS, DISK_AIO_URING };
+  int length = 10000;
+  char *data = rand_text(2 * length);
+  char *read_buf = calloc(2 * length, sizeof(char));
+  char *many_buf = calloc(8 * length, sizeof(char));
+
+  for(int e = 0; e < 2; e++){
+    int state[2] = { 0, 0 };
+    ssfs_req_t *many[8];
+    int fds[8];
+
+    mkssfs_format(1, &format);
+    disk_set_model(engines[e] == DISK_AIO_THREADS ? &model : NULL);
+    if(disk_aio_init(32, engines[e]) < 0){
+      fprintf(stderr, "Error: could not start disk I/O engine %d\n", engines[e]);
+      *err_no += 1;
+    }
+    int fd = ssfs_fopen("async");
+    ssfs_req_t *req = ssfs_fwrite_async(fd, data, length, NULL, NULL);
+    if(req == NULL || ssfs_wait(req) != length){
+      fprintf(stderr, "Error: ssfs_fwrite_async + ssfs_wait did not write %d bytes (engine %d)\n", length, engines[e]);
+      *err_no += 1;
+    }
+    ssfs_frseek(fd, 0);
+    req = ssfs_fread_async(fd, read_buf, length, NULL, NULL);
+    for(int i = 0; req != NULL && i < 100000 && !ssfs_poll(req); i++)
+      usleep(10);
+    if(req == NULL || !ssfs_poll(req) || ssfs_wait(req) != length || memcmp(read_buf, data, length) != 0){
+      fprintf(stderr, "Error: ssfs_fread_async + ssfs_wait did not read back what was written (engine %d)\n", engines[e]);
+      *err_no += 1;
+    }
+
+    if(ssfs_fwrite_async(fd, data + length, length, async_done, state) == NULL ||
+       async_wait_callback(state) != length){
+      fprintf(stderr, "Error: ssfs_fwrite_async callback got %d calls, result %d (engine %d)\n", state[1], state[0], engines[e]);
+      *err_no += 1;
+    }
+    state[0] = state[1] = 0;
+    memset(read_buf, 0, 2 * length);
+    ssfs_frseek(fd, length);
+    if(ssfs_fread_async(fd, read_buf, length, async_done, state) == NULL ||
+       async_wait_callback(state) != length || memcmp(read_buf, data + length, length) != 0){
+      fprintf(stderr, "Error: ssfs_fread_async callback got %d calls, result %d (engine %d)\n", state[1], state[0], engines[e]);
+      *err_no += 1;
+    }
+    ssfs_fclose(fd);
+
+    memset(many_buf, 0, 8 * length);
+    for(int i = 0; i < 8; i++){
+      fds[i] = ssfs_fopen("async");
+      ssfs_frseek(fds[i], i * 1000);
+      many[i] = ssfs_fread_async(fds[i], many_buf + i * length, length, NULL, NULL);
+    }
+    for(int i = 0; i < 8; i++){
+      if(many[i] == NULL || ssfs_wait(many[i]) != length || memcmp(many_buf + i * length, data + i * 1000, length) != 0){
+        fprintf(stderr, "Error: read %d of 8 in flight came back wrong (engine %d)\n", i, engines[e]);
+        *err_no += 1;
+      }
+      ssfs_fclose(fds[i]);
+    }
+
+    mkssfs_format(0, &format);
+    memset(read_buf, 0, 2 * length);
+    fd = ssfs_fopen("async");
+    if(ssfs_fread(fd, read_buf, 2 * length) != 2 * length || memcmp(read_buf, data, 2 * length) != 0){
+      fprintf(stderr, "Error: async writes lost after a remount (engine %d)\n", engines[e]);
+      *err_no += 1;
+    }
+    ssfs_fclose(fd);
+    disk_aio_shutdown();
+    disk_set_model(NULL);
+  }
+
+  free(data);
+  free(read_buf);
+  free(many_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+//Microseconds on the monotonic clock
+static long now_us(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+Requests in flight overlap: with the cache off and a real time model of
+a 32 deep queue at 20 ms a transfer, 16 async reads of blocks spread over
+a file have to finish in about one transfer time, where reading them one
+after the other takes 16 of them.
+*/
+int test_async_batch(int *err_no){
+  ssfs_format_t format = { "testbatch", 1024, 4096, 64 };
+  disk_model_t model = { DISK_LATENCY_FIXED, 20000, 0, 0, 32 };
+  int n = 16, block = 4096;
+  char *data = rand_text(n * 4 * block);
+  char *read_buf = calloc(n * block, sizeof(char));
+  ssfs_req_t *req[16];
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  int fd = ssfs_fopen("batch");
+  ssfs_fwrite(fd, data, n * 4 * block);
+  ssfs_flush();
+  ssfs_set_cache_size(0);
+  disk_set_model(&model);
+
+  long start = now_us();
+  for(int i = 0; i < n; i++){
+    ssfs_frseek(fd, i * 4 * block);
+    req[i] = ssfs_fread_async(fd, read_buf + i * block, block, NULL, NULL);
+  }
+  for(int i = 0; i < n; i++){
+    if(req[i] == NULL || ssfs_wait(req[i]) != block || memcmp(read_buf + i * block, data + i * 4 * block, block) != 0){
+      fprintf(stderr, "Error: async read %d of %d came back wrong\n", i, n);
+      errors++;
+    }
+  }
+  long took = now_us() - start;
+  if(took > 4 * model.latency_us){
+    fprintf(stderr, "Error: %d async reads took %ld us, %d us each one at a time\n", n, took, model.latency_us);
+    errors++;
+  }
+  disk_set_model(NULL);
+  ssfs_set_cache_size(256);	//the default
+  ssfs_fclose(fd);
+
+  free(data);
+  free(read_buf);
+  *err_no += errors;
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+//Writes length bytes at offset (-1 appends) to the named file
+static int write_file(char *name, char *data, int length, int offset){
+  int fd = ssfs_fopen(name);
+  if(offset >= 0)
+    ssfs_fwseek(fd, offset);
+  int ret = ssfs_fwrite(fd, data, length);
+  ssfs_fclose(fd);
+  return ret;
+}
+
+//Returns 1 if the named file holds exactly length bytes equal to data
+static int file_is(char *name, char *data, int length){
+  char *read_buf = calloc(length + 1, sizeof(char));
+  int fd = ssfs_fopen(name);
+  int n = ssfs_fread(fd, read_buf, length + 1);
+  ssfs_fclose(fd);
+  int same = n == length && memcmp(read_buf, data, length) == 0;
+  free(read_buf);
+  return same;
+}
+
+/*
+Snapshots: commit, change files, restore the older snapshot and go forward
+again, restore after a remount, and an fd on a file the snapshot does not
+have. Then keeps rewriting a file and committing until more than
+NUM_SHADOWS snapshots were taken: the oldest ones are dropped and the
+blocks only they held have to be swept back, or the disk fills up.
+*/
+int test_snapshots(int *err_no){
+  ssfs_format_t format = { "testsnap", 1024, 4096, 64 };
+  int big = 400 * 1024;
+  char *a1 = rand_text(5000), *a2 = rand_text(5000), *b = rand_text(3000);
+  char *big1 = rand_text(big), *big2 = rand_text(big);
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  write_file("a", a1, 5000, -1);
+  write_file("b", b, 3000, -1);
+  write_file("big", big1, big, -1);
+  int c1 = ssfs_commit();
+
+  //overwrite a in the middle, remove b, add c, overwrite part of big
+  write_file("a", a2 + 1000, 2000, 1000);
+  memcpy(a2, a1, 1000);
+  memcpy(a2 + 3000, a1 + 3000, 2000);
+  ssfs_remove("b");
+  write_file("c", b, 100, -1);
+  write_file("big", big2 + 300000, 50000, 300000);
+  memcpy(big2, big1, 300000);
+  memcpy(big2 + 350000, big1 + 350000, big - 350000);
+  int fd_c = ssfs_fopen("c");
+  int c2 = ssfs_commit();
+  if(c1 <= 0 || c2 <= c1){
+    fprintf(stderr, "Error: ssfs_commit returned %d then %d\n", c1, c2);
+    errors++;
+  }
+
+  if(ssfs_restore(c1) != 0 || !file_is("a", a1, 5000) || !file_is("b", b, 3000) || !file_is("big", big1, big)){
+    fprintf(stderr, "Error: Restoring the first snapshot did not bring its files back\n");
+    errors++;
+  }
+  if(ssfs_fread(fd_c, b, 1) != -1){
+    fprintf(stderr, "Error: The fd of a file the snapshot does not have is still open\n");
+    errors++;
+  }
+  if(ssfs_restore(c2) != 0 || !file_is("a", a2, 5000) || !file_is("c", b, 100) || !file_is("big", big2, big)){
+    fprintf(stderr, "Error: Restoring the second snapshot did not bring its files back\n");
+    errors++;
+  }
+  if(ssfs_restore(c2 + 1) != -1){
+    fprintf(stderr, "Error: Restored a snapshot that was never taken\n");
+    errors++;
+  }
+
+  mkssfs_format(0, &format);
+  if(ssfs_restore(c1) != 0 || !file_is("big", big1, big)){
+    fprintf(stderr, "Error: Restoring a snapshot after a remount failed\n");
+    errors++;
+  }
+
+  //12 rounds of 400 blocks on a 4096-block disk: only fits if dropped snapshots are swept
+  int commits[12];
+  for(int i = 0; i < 12; i++){
+    char *data = i % 2 ? big1 : big2;
+    data[0] = 'A' + i;
+    if(write_file("big", data, big, 0) != big || (commits[i] = ssfs_commit()) <= 0){
+      fprintf(stderr, "Error: Round %d of rewriting and committing failed\n", i);
+      errors++;
+      break;
+    }
+  }
+  if(errors == 0 && ssfs_restore(commits[0]) != -1){
+    fprintf(stderr, "Error: The oldest snapshot was not dropped\n");
+    errors++;
+  }
+  if(errors == 0 && (ssfs_restore(commits[10]) != 0 || !file_is("big", big2, big) ||
+                     ssfs_restore(commits[11]) != 0 || !file_is("big", big1, big))){
+    fprintf(stderr, "Error: Restoring a recent snapshot failed\n");
+    errors++;
+  }
+
+  *err_no += errors;
+  free(a1);
+  free(a2);
+  free(b);
+  free(big1);
+  free(big2);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+int test_disk_failure(int *err_no){
+  ssfs_format_t format = { "testfail", 1024, 4096, 64 };
+  disk_model_t broken = disk_model_ssd;
+  int length = 3000;
+  char *data = rand_text(length);
+  char *read_buf = calloc(length + 100, sizeof(char));
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  int fd = ssfs_fopen("fail");
+  ssfs_fwrite(fd, data, length);
+  ssfs_flush();
+
+  //no cache, every transfer fails and is not retried
+  ssfs_set_cache_size(0);
+  broken.fail_rate = 1;
+  broken.max_retry = 0;
+  broken.virtual_time = 1;
+  disk_set_model(&broken);
+  ssfs_frseek(fd, 0);
+  if(ssfs_fread(fd, read_buf, length) != -1){
+    fprintf(stderr, "Error: ssfs_fread did not report a failed disk read\n");
+    errors++;
+  }
+  ssfs_fwseek(fd, 100);
+  if(ssfs_fwrite(fd, data, length) != -1){
+    fprintf(stderr, "Error: ssfs_fwrite did not report a failed disk write\n");
+    errors++;
+  }
+  disk_set_model(NULL);
+  ssfs_set_cache_size(256);	//the default
+
+  //the failed write left the size alone
+  ssfs_frseek(fd, 0);
+  if(ssfs_fread(fd, read_buf, length + 100) != length){
+    fprintf(stderr, "Error: A failed ssfs_fwrite changed the file size\n");
+    errors++;
+  }
+  ssfs_fclose(fd);
+
+  *err_no += errors;
+  free(data);
+  free(read_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+int test_stats(int *err_no){
+  ssfs_format_t format = { "teststats", 1024, 4096, 64 };
+  ssfs_stats_t before, after, zero;
+  int length = 3000;
+  char *data = rand_text(length);
+  char *read_buf = calloc(length, sizeof(char));
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  ssfs_reset_stats();
+  ssfs_get_stats(&before);
+  memset(&zero, 0, sizeof(zero));
+  if(memcmp(&before, &zero, sizeof(zero)) != 0){
+    fprintf(stderr, "Error: ssfs_reset_stats left a counter set\n");
+    errors++;
+  }
+
+  //3 new blocks, then a partial rewrite of one of them
+  int fd = ssfs_fopen("stats");
+  ssfs_fwrite(fd, data, length);
+  ssfs_fwseek(fd, 100);
+  ssfs_fwrite(fd, data, 50);
+  ssfs_get_stats(&after);
+  if(after.bytes_written - before.bytes_written != length + 50 || after.fwrite.calls - before.fwrite.calls != 2 ||
+     after.rmw_blocks - before.rmw_blocks != 1 || after.fopen.calls - before.fopen.calls != 1 ||
+     after.allocs - before.allocs < 1 || after.meta_syncs - before.meta_syncs < 1){
+    fprintf(stderr, "Error: Writing %d then 50 bytes moved the counters wrong\n", length);
+    errors++;
+  }
+
+  //the blocks just written are in the cache
+  before = after;
+  ssfs_frseek(fd, 0);
+  ssfs_fread(fd, read_buf, length);
+  ssfs_get_stats(&after);
+  if(after.bytes_read - before.bytes_read != length || after.fread.calls - before.fread.calls != 1 ||
+     after.cache_hits - before.cache_hits < 3 || after.bytes_written != before.bytes_written){
+    fprintf(stderr, "Error: Reading %d bytes moved the counters wrong\n", length);
+    errors++;
+  }
+
+  before = after;
+  ssfs_flush();
+  ssfs_get_stats(&after);
+  if(after.disk_writes - before.disk_writes < 1 || after.blocks_written - before.blocks_written < 3){
+    fprintf(stderr, "Error: Flushing 3 dirty blocks did not count their writes\n");
+    errors++;
+  }
+
+  //dumping only reads the counters
+  before = after;
+  ssfs_dump_stats();
+  ssfs_get_stats(&after);
+  if(memcmp(&before, &after, sizeof(after)) != 0){
+    fprintf(stderr, "Error: ssfs_dump_stats changed a counter\n");
+    errors++;
+  }
+  ssfs_fclose(fd);
+
+  *err_no += errors;
+  free(data);
+  free(read_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Vector and positional I/O: a gather write with an empty buffer in it, empty
+vectors, a scatter read cut short by the end of the file, and pread/pwrite
+leaving the read and write pointers where they were.
+*/
+int test_vector_io(int *err_no){
+  ssfs_format_t format = { "testvec", 1024, 4096, 64 };
+  char *data = rand_text(3000);
+  char a[300], b[500], tail[10];
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  int fd = ssfs_fopen("vec");
+  struct iovec out[3] = { { data, 100 }, { NULL, 0 }, { data + 100, 2500 } };
+  if(ssfs_fwritev(fd, out, 3) != 2600 || ssfs_fwritev(fd, out + 1, 1) != 0 || !file_is("vec", data, 2600)){
+    fprintf(stderr, "Error: ssfs_fwritev did not write its buffers one after the other\n");
+    errors++;
+  }
+
+  //300 bytes into a, the last 300 of the file into b; the rest of b is left alone
+  struct iovec in[2] = { { a, sizeof(a) }, { b, sizeof(b) } };
+  memset(b, 'z', sizeof(b));
+  ssfs_frseek(fd, 2000);
+  if(ssfs_freadv(fd, in, 2) != 600 || memcmp(a, data + 2000, 300) != 0 ||
+     memcmp(b, data + 2300, 300) != 0 || b[300] != 'z' || ssfs_freadv(fd, in, 0) != -1){
+    fprintf(stderr, "Error: ssfs_freadv did not scatter the end of the file\n");
+    errors++;
+  }
+  in[0].iov_len = in[1].iov_len = 0;
+  if(ssfs_freadv(fd, in, 2) != 0){
+    fprintf(stderr, "Error: ssfs_freadv of empty buffers did not return 0\n");
+    errors++;
+  }
+
+  //the write pointer stays at 2600 and the read pointer at 2600
+  if(ssfs_pwrite(fd, data + 2600, 200, 1000) != 200 || ssfs_fwrite(fd, data + 2800, 10) != 10){
+    fprintf(stderr, "Error: ssfs_pwrite failed\n");
+    errors++;
+  }
+  memcpy(data + 1000, data + 2600, 200);
+  memcpy(data + 2600, data + 2800, 10);
+  if(!file_is("vec", data, 2610)){
+    fprintf(stderr, "Error: ssfs_pwrite moved the write pointer or wrote the wrong place\n");
+    errors++;
+  }
+  if(ssfs_pread(fd, b, 300, 2500) != 110 || memcmp(b, data + 2500, 110) != 0 ||
+     ssfs_pread(fd, b, 10, 2610) != 0 || ssfs_fread(fd, tail, 10) != 10 || memcmp(tail, data + 2600, 10) != 0){
+    fprintf(stderr, "Error: ssfs_pread moved the read pointer or read the wrong place\n");
+    errors++;
+  }
+  if(ssfs_pwrite(fd, data, 10, 2611) != -1 || ssfs_pread(fd, b, 10, 2611) != -1 || ssfs_pread(fd, b, 10, -1) != -1){
+    fprintf(stderr, "Error: pread/pwrite past the end of the file did not fail\n");
+    errors++;
+  }
+  ssfs_fclose(fd);
+
+  *err_no += errors;
+  free(data);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Directories: nested mkdir, files with the same name in different
+directories, the errors of mkdir/rmdir/remove/fopen on the wrong kind of
+path, and the tree surviving a remount.
+*/
+int test_directories(int *err_no){
+  ssfs_format_t format = { "testdirs", 1024, 4096, 64 };
+  char *d1 = rand_text(2000), *d2 = rand_text(500);
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  if(ssfs_mkdir("d") != 0 || ssfs_mkdir("d/e") != 0 || ssfs_mkdir("/d/e/g") != 0){
+    fprintf(stderr, "Error: Could not make nested directories\n");
+    errors++;
+  }
+  if(ssfs_mkdir("d") != -1 || ssfs_mkdir("x/y") != -1 || ssfs_mkdir("d/waytoolongforadirectoryname") != -1){
+    fprintf(stderr, "Error: mkdir of an existing directory, under a missing one or with a bad name worked\n");
+    errors++;
+  }
+
+  //same name at the top and two levels down
+  if(write_file("d/e/f", d1, 2000, -1) != 2000 || write_file("f", d2, 500, -1) != 500 ||
+     !file_is("/d/e/f", d1, 2000) || !file_is("f", d2, 500)){
+    fprintf(stderr, "Error: Files named f in different directories got mixed up\n");
+    errors++;
+  }
+  if(ssfs_fopen("d") != -1 || ssfs_fopen("nope/f") != -1 || ssfs_fopen("d/e/f/h") != -1){
+    fprintf(stderr, "Error: Opening a directory, or a file under a missing directory or a file, worked\n");
+    errors++;
+  }
+
+  if(ssfs_remove("d/e") != -1 || ssfs_rmdir("d/e") != -1 || ssfs_rmdir("d/e/f") != -1 || ssfs_rmdir("d/nope") != -1){
+    fprintf(stderr, "Error: Removed a directory with ssfs_remove, a non-empty one, or a file with ssfs_rmdir\n");
+    errors++;
+  }
+
+  mkssfs_format(0, &format);
+  if(!file_is("d/e/f", d1, 2000) || !file_is("f", d2, 500)){
+    fprintf(stderr, "Error: The tree did not survive a remount\n");
+    errors++;
+  }
+
+  if(ssfs_remove("d/e/f") != 0 || ssfs_rmdir("d/e/g") != 0 || ssfs_rmdir("d/e") != 0 || ssfs_rmdir("d") != 0){
+    fprintf(stderr, "Error: Could not empty and remove the tree\n");
+    errors++;
+  }
+  if(ssfs_fopen("d/e/f") != -1 || ssfs_mkdir("d/e") != -1 || !file_is("f", d2, 500)){
+    fprintf(stderr, "Error: A removed directory can still be used\n");
+    errors++;
+  }
+
+  *err_no += errors;
+  free(d1);
+  free(d2);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Async disk requests in order: on every engine, a read queued right after a
+write to the same block must see the write, even when the write is
+already running. Uses free blocks in the middle of a fresh volume.
+*/
+int test_aio_order(int *err_no){
+  ssfs_format_t format = { "testorder", 1024, 4096, 64 };
+  int engines[2] = { DISK_AIO_THREADS, DISK_AIO_URING };
+  static char wbuf[16][1024], rbuf[16][1024];
+  static disk_io_t wio[16], rio[16];
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  for(int e = 0; e < 2; e++){
+    int stale = 0;
+    disk_aio_init(32, engines[e]);
+    for(int round = 0; round < 200; round++){
+      for(int j = 0; j < 16; j++){
+        memset(wbuf[j], 'a' + (round + j) % 26, 1024);
+        memset(rbuf[j], 0, 1024);
+        wio[j] = (disk_io_t){ DISK_IO_WRITE, 2048 + 3 * j, 1, wbuf[j] };
+        rio[j] = (disk_io_t){ DISK_IO_READ, 2048 + 3 * j, 1, rbuf[j] };
+        submit_blocks(&wio[j]);
+        submit_blocks(&rio[j]);
+      }
+      disk_aio_drain();
+      for(int j = 0; j < 16; j++)
+        if(wio[j].result != 1 || rio[j].result != 1 || memcmp(wbuf[j], rbuf[j], 1024) != 0)
+          stale++;
+    }
+    if(stale > 0){
+      fprintf(stderr, "Error: %d async reads on engine %d passed the write before them\n", stale, engines[e]);
+      errors++;
+    }
+  }
+  disk_aio_shutdown();
+
+  *err_no += errors;
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Block cache: blocks just written are read back without going to the disk,
+and stay dirty in the cache until a flush writes them. Then a cache of 4
+blocks under a 64 block file: every block is evicted and written back at
+least once, and all of them read back, before and after a remount.
+*/
+int test_cache(int *err_no){
+  ssfs_format_t format = { "testcache", 1024, 4096, 64 };
+  ssfs_stats_t before, after;
+  int length = 8 * 1024, big = 64 * 1024;
+  char *data = rand_text(big);
+  char *read_buf = calloc(big, sizeof(char));
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  ssfs_get_stats(&before);
+  write_file("cached", data, length, -1);
+  int fd = ssfs_fopen("cached");
+  ssfs_fread(fd, read_buf, length);
+  ssfs_fclose(fd);
+  ssfs_get_stats(&after);
+  if(memcmp(read_buf, data, length) != 0 || after.blocks_read != before.blocks_read ||
+     after.cache_hits - before.cache_hits < 8){
+    fprintf(stderr, "Error: Reading 8 blocks just written read %ld blocks from disk, hit %ld\n",
+            after.blocks_read - before.blocks_read, after.cache_hits - before.cache_hits);
+    errors++;
+  }
+  if(after.blocks_written != before.blocks_written){
+    fprintf(stderr, "Error: %ld blocks reached the disk before a flush\n", after.blocks_written - before.blocks_written);
+    errors++;
+  }
+  before = after;
+  ssfs_flush();
+  ssfs_get_stats(&after);
+  if(after.blocks_written - before.blocks_written < 8){
+    fprintf(stderr, "Error: Flushing wrote %ld blocks, not the 8 dirty ones\n", after.blocks_written - before.blocks_written);
+    errors++;
+  }
+
+  ssfs_set_cache_size(4);
+  write_file("evicted", data, big, -1);
+  if(!file_is("evicted", data, big)){
+    fprintf(stderr, "Error: A file 16 times the cache size did not read back\n");
+    errors++;
+  }
+  mkssfs_format(0, &format);
+  if(!file_is("evicted", data, big) || !file_is("cached", data, length)){
+    fprintf(stderr, "Error: Files written through a small cache were lost on remount\n");
+    errors++;
+  }
+  ssfs_set_cache_size(256);	//the default
+
+  *err_no += errors;
+  free(data);
+  free(read_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Incremental metadata: creating a file and writing to it only logs the
+dir, IBM, FBM and WM blocks it changed, so it costs the same number of
+metadata blocks on a volume of 64 inodes as on one of 16384.
+*/
+int test_meta_blocks(int *err_no){
+  ssfs_format_t small = { "testmeta", 1024, 8192, 64 };
+  ssfs_format_t large = { "testmeta", 1024, 8192, 16384 };
+  ssfs_format_t *formats[2] = { &small, &large };
+  ssfs_stats_t before, after;
+  long logged[2];
+  int errors = 0;
+
+  for(int v = 0; v < 2; v++){
+    mkssfs_format(1, formats[v]);
+    write_file("first", test_str, 100, -1);
+    ssfs_get_stats(&before);
+    write_file("second", test_str, 100, -1);
+    ssfs_get_stats(&after);
+    logged[v] = after.meta_blocks - before.meta_blocks;
+  }
+  if(logged[0] < 1 || logged[0] > 8 || logged[1] != logged[0]){
+    fprintf(stderr, "Error: Creating a file logged %ld metadata blocks with %d inodes, %ld with %d\n",
+            logged[0], small.num_inodes, logged[1], large.num_inodes);
+    errors++;
+  }
+
+  *err_no += errors;
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+//Copies the image file from to the image file to, as a crash would leave it
+static int copy_image(char *from, char *to){
+  char buf[4096];
+  size_t n;
+  FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+  if(in == NULL || out == NULL){
+    if(in != NULL) fclose(in);
+    if(out != NULL) fclose(out);
+    return -1;
+  }
+  while((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    fwrite(buf, 1, n, out);
+  fclose(in);
+  fclose(out);
+  return 0;
+}
+
+//Flips the bits of the byte at offset at of an image file
+static void flip_byte(FILE *fp, long at){
+  fseek(fp, at, SEEK_SET);
+  int c = fgetc(fp);
+  fseek(fp, at, SEEK_SET);
+  fputc(c ^ 0xff, fp);
+}
+
+//Flips a byte in the last block of the newest journal transaction of an image,
+//as if the write of that transaction was torn; returns -1 if there is none
+static int tear_last_tx(char *image, int block_size){
+  char *block = malloc(block_size);
+  long newest = -1, pos = 0;
+  int seq = -1, count = 0;
+  FILE *fp = fopen(image, "r+b");
+  if(fp == NULL){
+    free(block);
+    return -1;
+  }
+  for(; fread(block, 1, block_size, fp) == (size_t)block_size; pos++){
+    int *fields = (int *)block;	//magic, seq, count
+    if(memcmp(block, "JTX1", 4) == 0 && fields[1] > seq){
+      newest = pos;
+      seq = fields[1];
+      count = fields[2];
+    }
+  }
+  if(newest != -1)
+    flip_byte(fp, (newest + count) * block_size + block_size / 2);
+  fclose(fp);
+  free(block);
+  return newest == -1 ? -1 : 0;
+}
+
+/*
+Journal replay: two files created and flushed in two transactions, then
+the image is copied as a crash would leave it. Mounting the copy replays
+both; mounting a copy whose second transaction was torn replays only the
+first, so the second file is not there at all.
+*/
+int test_journal_replay(int *err_no){
+  ssfs_format_t format = { "testjournal", 1024, 4096, 64 };
+  ssfs_format_t whole = { "testjournal.whole", 1024, 4096, 64 };
+  ssfs_format_t torn = { "testjournal.torn", 1024, 4096, 64 };
+  char *data = rand_text(3000);
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  write_file("a", data, 3000, -1);
+  ssfs_flush();
+  write_file("b", data, 2000, -1);
+  ssfs_flush();
+  if(copy_image(format.image, whole.image) != 0 || copy_image(format.image, torn.image) != 0 ||
+     tear_last_tx(torn.image, format.block_size) != 0){
+    fprintf(stderr, "Error: Could not make the crash images, or no transaction was in the journal\n");
+    errors++;
+  }
+
+  mkssfs_format(0, &whole);
+  if(!file_is("a", data, 3000) || !file_is("b", data, 2000)){
+    fprintf(stderr, "Error: Replaying two committed transactions lost a file\n");
+    errors++;
+  }
+  mkssfs_format(0, &torn);
+  if(!file_is("a", data, 3000)){
+    fprintf(stderr, "Error: A torn transaction took the one before it down too\n");
+    errors++;
+  }
+  if(ssfs_remove("b") != -1){
+    fprintf(stderr, "Error: A torn transaction was replayed\n");
+    errors++;
+  }
+
+  *err_no += errors;
+  free(data);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Name index: 2000 files, each holding its own name, then every third one
+removed. Every lookup has to land on the right file, removed names have
+to be gone, and the same holds after a remount rebuilds the index.
+*/
+int test_name_index(int *err_no){
+  ssfs_format_t format = { "testindex", 1024, 8192, 4096 };
+  int num = 2000;
+  char name[16];
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  for(int i = 0; i < num; i++){
+    snprintf(name, sizeof(name), "n%d", i);
+    write_file(name, name, strlen(name), -1);
+  }
+  for(int i = 0; i < num; i += 3){
+    snprintf(name, sizeof(name), "n%d", i);
+    ssfs_remove(name);
+  }
+
+  for(int mount = 0; mount < 2; mount++){
+    int wrong = 0, kept = 0;
+    for(int i = 0; i < num; i++){
+      snprintf(name, sizeof(name), "n%d", i);
+      if(i % 3 != 0 && !file_is(name, name, strlen(name)))
+        wrong++;
+      if(i % 3 == 0 && ssfs_remove(name) != -1)
+        kept++;
+    }
+    if(wrong > 0 || kept > 0){
+      fprintf(stderr, "Error: %d of %d names found the wrong file, %d removed names were still there%s\n",
+              wrong, num, kept, mount ? " after a remount" : "");
+      errors++;
+    }
+    mkssfs_format(0, &format);
+  }
+
+  *err_no += errors;
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+//Appends 1 KiB at a time to the named file until a write fails; returns the bytes it took
+static int fill_disk(char *name, char *chunk){
+  int fd = ssfs_fopen(name);
+  int total = 0;
+  while(ssfs_fwrite(fd, chunk, 1024) == 1024)
+    total += 1024;
+  ssfs_fclose(fd);
+  return total;
+}
+
+/*
+Free block map: a file grown until the disk is full gets most of the
+blocks, and removing it gives back exactly as many, so the same file fits
+again, before and after a remount. The next-fit cursor keeps the words
+scanned per allocation small while the disk fills up.
+*/
+int test_free_blocks(int *err_no){
+  ssfs_format_t format = { "testfbm", 1024, 2048, 64 };
+  ssfs_stats_t before, after;
+  char *chunk = rand_text(1024);
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  ssfs_get_stats(&before);
+  int full = fill_disk("fill", chunk);
+  ssfs_get_stats(&after);
+  long allocs = after.allocs - before.allocs, words = after.alloc_words - before.alloc_words;
+  if(full < 1500 * 1024){
+    fprintf(stderr, "Error: Only %d bytes fit on a disk of %d blocks\n", full, format.num_blocks);
+    errors++;
+  }
+  if(allocs < 1 || words > 4 * allocs){
+    fprintf(stderr, "Error: %ld allocations scanned %ld FBM words\n", allocs, words);
+    errors++;
+  }
+
+  for(int mount = 0; mount < 2; mount++){
+    ssfs_remove("fill");
+    int again = fill_disk("fill", chunk);
+    if(again != full){
+      fprintf(stderr, "Error: %d bytes fit after a remove, %d the first time%s\n", again, full, mount ? ", after a remount" : "");
+      errors++;
+    }
+    mkssfs_format(0, &format);
+  }
+
+  *err_no += errors;
+  free(chunk);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Extents: with the cache off, a 64 block file written in one call, and two
+files appended to in turns 4 KiB at a time, read back in one call each
+with a handful of disk reads rather than one per block.
+*/
+int test_extents(int *err_no){
+  ssfs_format_t format = { "testextent", 1024, 4096, 64 };
+  ssfs_stats_t before, after;
+  int length = 64 * 1024;
+  char *data = rand_text(length);
+  char *read_buf = calloc(length, sizeof(char));
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  write_file("whole", data, length, -1);
+  for(int off = 0; off < length; off += 4096){
+    write_file("turn1", data + off, 4096, -1);
+    write_file("turn2", data + off, 4096, -1);
+  }
+  mkssfs_format(0, &format);
+  ssfs_set_cache_size(0);
+
+  char *names[3] = { "whole", "turn1", "turn2" };
+  for(int f = 0; f < 3; f++){
+    int fd = ssfs_fopen(names[f]);
+    ssfs_get_stats(&before);
+    int n = ssfs_fread(fd, read_buf, length);
+    ssfs_get_stats(&after);
+    ssfs_fclose(fd);
+    if(n != length || memcmp(read_buf, data, length) != 0){
+      fprintf(stderr, "Error: %s did not read back\n", names[f]);
+      errors++;
+    }
+    if(after.disk_reads - before.disk_reads > (f == 0 ? 4 : 20)){
+      fprintf(stderr, "Error: Reading the 64 blocks of %s took %ld disk reads\n", names[f], after.disk_reads - before.disk_reads);
+      errors++;
+    }
+  }
+  ssfs_set_cache_size(256);	//the default
+
+  *err_no += errors;
+  free(data);
+  free(read_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Read-ahead: after a remount empties the cache, reading a 128 block file
+front to back 1 KiB at a time finds most blocks already cached, and goes
+to the disk a few times instead of once per block.
+*/
+int test_read_ahead(int *err_no){
+  ssfs_format_t format = { "testahead", 1024, 4096, 64 };
+  ssfs_stats_t before, after;
+  int length = 128 * 1024;
+  char *data = rand_text(length);
+  char *read_buf = calloc(length, sizeof(char));
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  write_file("stream", data, length, -1);
+  mkssfs_format(0, &format);
+
+  int fd = ssfs_fopen("stream");
+  ssfs_get_stats(&before);
+  for(int off = 0; off < length; off += 1024)
+    ssfs_fread(fd, read_buf + off, 1024);
+  ssfs_get_stats(&after);
+  ssfs_fclose(fd);
+  if(memcmp(read_buf, data, length) != 0){
+    fprintf(stderr, "Error: A file read 1 KiB at a time did not read back\n");
+    errors++;
+  }
+  if(after.disk_reads - before.disk_reads > 16 || after.cache_hits - before.cache_hits < 96){
+    fprintf(stderr, "Error: Reading 128 blocks in order took %ld disk reads and hit the cache %ld times\n",
+            after.disk_reads - before.disk_reads, after.cache_hits - before.cache_hits);
+    errors++;
+  }
+
+  *err_no += errors;
+  free(data);
+  free(read_buf);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Full block writes: overwriting whole blocks and appending into fresh
+blocks read nothing back; an overwrite that starts and ends inside
+blocks reads back exactly those two. The file holds the right bytes after
+each write and after a remount.
+*/
+int test_full_blocks(int *err_no){
+  ssfs_format_t format = { "testfull", 1024, 4096, 64 };
+  ssfs_stats_t before, after;
+  int length = 8 * 1024;
+  char *data = rand_text(length), *other = rand_text(length);
+  char *expect = calloc(length, sizeof(char));
+  int size = 0, errors = 0;
+
+  mkssfs_format(1, &format);
+  struct { int offset, len; long rmw; const char *what; } writes[] = {
+    { 0, 4 * 1024, 0, "a write into fresh blocks" },
+    { 4 * 1024, 3 * 1024 + 500, 0, "an append ending inside a fresh block" },
+    { 2 * 1024, 4 * 1024, 0, "a whole block overwrite" },
+    { 1024 + 100, 3 * 1024, 2, "an overwrite inside blocks at both ends" },
+  };
+  for(int w = 0; w < 4; w++){
+    char *src = w % 2 ? other : data;
+    ssfs_get_stats(&before);
+    write_file("full", src + writes[w].offset, writes[w].len, writes[w].offset);
+    ssfs_get_stats(&after);
+    memcpy(expect + writes[w].offset, src + writes[w].offset, writes[w].len);
+    if(size < writes[w].offset + writes[w].len)
+      size = writes[w].offset + writes[w].len;
+    if(after.rmw_blocks - before.rmw_blocks != writes[w].rmw){
+      fprintf(stderr, "Error: %s read back %ld blocks, not %ld\n", writes[w].what, after.rmw_blocks - before.rmw_blocks, writes[w].rmw);
+      errors++;
+    }
+    if(!file_is("full", expect, size)){
+      fprintf(stderr, "Error: The file is wrong after %s\n", writes[w].what);
+      errors++;
+    }
+  }
+  mkssfs_format(0, &format);
+  if(!file_is("full", expect, size)){
+    fprintf(stderr, "Error: Full block writes were lost on remount\n");
+    errors++;
+  }
+
+  *err_no += errors;
+  free(data);
+  free(other);
+  free(expect);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Sparse formatting: a fresh 256 MiB volume only has its metadata blocks
+allocated in the image file, blocks never written read as zeroes, and
+the volume is usable right away.
+*/
+int test_sparse_format(int *err_no){
+  ssfs_format_t format = { "testsparse", 4096, 65536, 1024 };
+  long size = (long)format.block_size * format.num_blocks;
+  char *block = malloc(format.block_size);
+  char *zero = calloc(format.block_size, sizeof(char));
+  struct stat st;
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  if(stat(format.image, &st) != 0 || st.st_size != size || (long)st.st_blocks * 512 > size / 16){
+    fprintf(stderr, "Error: A fresh %ld byte image has %ld bytes allocated\n", size, (long)st.st_blocks * 512);
+    errors++;
+  }
+  if(read_blocks(format.num_blocks / 2, 1, block) != 1 || memcmp(block, zero, format.block_size) != 0){
+    fprintf(stderr, "Error: A block never written did not read as zeroes\n");
+    errors++;
+  }
+  write_file("sparse", test_str, strlen(test_str), -1);
+  mkssfs_format(0, &format);
+  if(!file_is("sparse", test_str, strlen(test_str))){
+    fprintf(stderr, "Error: A file on a sparse volume was lost on remount\n");
+    errors++;
+  }
+
+  *err_no += errors;
+  free(block);
+  free(zero);
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Superblock validation: a copy of a volume with one byte of its superblock
+changed, in a field nothing but the checksum covers, and one with a wrong
+magic, both refuse to mount. The untouched volume still mounts after them.
+*/
+int test_superblock_check(int *err_no){
+  ssfs_format_t format = { "testsuper", 1024, 4096, 64 };
+  ssfs_format_t bad_sum = { "testsuper.sum", 1024, 4096, 64 };
+  ssfs_format_t bad_magic = { "testsuper.magic", 1024, 4096, 64 };
+  int errors = 0;
+
+  mkssfs_format(1, &format);
+  write_file("super", test_str, strlen(test_str), -1);
+  mkssfs_format(0, &format);	//writes everything back
+  copy_image(format.image, bad_sum.image);
+  copy_image(format.image, bad_magic.image);
+  FILE *fp = fopen(bad_sum.image, "r+b");
+  flip_byte(fp, 8);	//file_system_size
+  fclose(fp);
+  fp = fopen(bad_magic.image, "r+b");
+  flip_byte(fp, 0);
+  fclose(fp);
+
+  if(mkssfs_format(0, &bad_sum) != -1){
+    fprintf(stderr, "Error: A superblock with a bad checksum was mounted\n");
+    errors++;
+  }
+  if(mkssfs_format(0, &bad_magic) != -1){
+    fprintf(stderr, "Error: A superblock with a bad magic was mounted\n");
+    errors++;
+  }
+  if(mkssfs_format(0, &format) != 0 || !file_is("super", test_str, strlen(test_str))){
+    fprintf(stderr, "Error: A good volume did not mount after bad ones were refused\n");
+    errors++;
+  }
+
+  *err_no += errors;
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
+
+/*
+Inode bitmap: files are created until the volume runs out of inodes.
+Removing one lets exactly one more file in, before and after a remount,
+and the files that stayed keep their data.
+*/
+int test_inode_reuse(int *err_no){
+  ssfs_format_t format = { "testinodes", 1024, 4096, 64 };
+  char name[16];
+  int created = 0, errors = 0;
+
+  mkssfs_format(1, &format);
+  for(;; created++){
+    snprintf(name, sizeof(name), "i%d", created);
+    if(write_file(name, name, strlen(name), -1) != (int)strlen(name))
+      break;
+  }
+  if(created < format.num_inodes / 2){
+    fprintf(stderr, "Error: Only %d files fit in %d inodes\n", created, format.num_inodes);
+    errors++;
+  }
+
+  for(int mount = 0; mount < 2; mount++){
+    char *gone = mount ? "i3" : "i17";
+    char *fresh = mount ? "again" : "new";
+    ssfs_remove(gone);
+    if(write_file(fresh, fresh, strlen(fresh), -1) != (int)strlen(fresh)){
+      fprintf(stderr, "Error: The inode of a removed file was not reused%s\n", mount ? " after a remount" : "");
+      errors++;
+    }
+    if(ssfs_fopen("extra") != -1){
+      fprintf(stderr, "Error: A file was created with no inode free%s\n", mount ? " after a remount" : "");
+      errors++;
+    }
+    mkssfs_format(0, &format);
+  }
+
+  int wrong = 0;
+  for(int i = 0; i < created; i++){
+    snprintf(name, sizeof(name), "i%d", i);
+    if(i != 3 && i != 17 && !file_is(name, name, strlen(name)))
+      wrong++;
+  }
+  if(wrong > 0 || !file_is("new", "new", 3) || !file_is("again", "again", 5)){
+    fprintf(stderr, "Error: %d files lost their data while inodes were reused\n", wrong);
+    errors++;
+  }
+
+  *err_no += errors;
+  printf("\n-------------------------------\nTest_num[%d]: Current Error Num: %d\n--------------------------------\n\n", test_num, *err_no);
+  test_num++;
+  return 0;
+}
@@ -7,7 +7,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "sfs_api.h"
+#include "disk_emu.h"
 
 /* The maximum file name length. We assume that filenames can contain
  * upper-case letters and periods ('.') characters. Feel free to
@@ -37,17 +40,20 @@ static char test_str[] = "Graphic Card is life. I need a 1080 for Christmas. As
  
 //Random Text Generators
 char *rand_name();
+char *rand_text(int length);
 
 //Seek
 int test_seek(int *file_id, int *file_size, int *write_ptr, char **write_buf, int num_file, int offset, int *err_no);
 
 //Read Functions
+int test_read_ahead(int *err_no);
 int test_read_all_files(int *file_id, int *file_size, char **write_buf, int num_file, int *err_no);
 int test_simple_read_files(int *file_id, int *file_size, char **write_buf, int num_file, int *err_no);
 int test_difficult_read_files(int *file_id, int *file_size, int *write_ptr, char **write_buf, int index, int read_length, int *err_no);
 int test_random_read_files(int *file_id, int *file_size, int *write_ptr, char **write_buf ,int num_file, int *err_no);
 
 //Write Function
+int test_full_blocks(int *err_no);
 int test_simple_write_files(int *file_id, int *file_size, int *write_ptr, char **write_buf, int num_file, int *err_no);
 int test_difficult_write_files(int *file_id, int *file_size, int *write_ptr, char **write_buf, int num_file, int *err_no);
 int test_write_to_overflow(int *file_id, int *file_size, char **write_buf, int num_file, int *err_no);
@@ -64,6 +70,35 @@ int test_overflow_open(int *file_id, int *file_sizes, int *write_ptr, char **fil
 
 //Test persistence
 int test_persistence(int *error, int write_length);
+int test_fbm_span(int *err_no);
+int test_sparse_format(int *err_no);
+int test_superblock_check(int *err_no);
+int test_free_blocks(int *err_no);
+int test_extents(int *err_no);
+
+//Async calls
+int test_async(int *err_no);
+int test_aio_order(int *err_no);
+int test_async_batch(int *err_no);
+
+//Snapshots
+int test_snapshots(int *err_no);
+//Disk failures
+int test_disk_failure(int *err_no);
+//Statistics
+int test_stats(int *err_no);
+//Vector and positional I/O
+int test_vector_io(int *err_no);
+//Directories
+int test_directories(int *err_no);
+//Block cache
+int test_cache(int *err_no);
+//Metadata
+int test_meta_blocks(int *err_no);
+int test_journal_replay(int *err_no);
+//Name lookups
+int test_name_index(int *err_no);
+int test_inode_reuse(int *err_no);
 
 //Help functionn
 int free_name_element(char **name_list, int num_file);